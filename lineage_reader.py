@@ -0,0 +1,135 @@
+#Nanolife - Simple artificial life simulator
+
+#Copyright 2011 Mateus Zitelli <zitellimateus@gmail.com>
+
+#This program is free software; you can redistribute it and/or modify
+#it under the terms of the GNU General Public License as published by
+#the Free Software Foundation; either version 2 of the License, or
+#(at your option) any later version.
+
+#This program is distributed in the hope that it will be useful,
+#but WITHOUT ANY WARRANTY; without even the implied warranty of
+#MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#GNU General Public License for more details.
+
+#You should have received a copy of the GNU General Public License
+#along with this program; if not, write to the Free Software
+#Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#MA 02110-1301, USA.
+
+# Queries over the lineage file written by "b.bin --lineage FILE".
+#
+#   python lineage_reader.py FILE info
+#   python lineage_reader.py FILE genome ID
+#   python lineage_reader.py FILE ancestors ID [DEPTH]
+#   python lineage_reader.py FILE descendants ID [DEPTH]
+#
+# Ids are dense from 1, so bot n is record n - 1 and ancestor walks seek
+# straight to it. Descendant queries use FILE.children, a sorted list of
+# (parent, child) pairs built on first use.
+# "ancestors" prints the same lines as the G key, so its output can be fed
+# to genetic_tree_reader.py as genetic_tree.data.
+from __future__ import print_function
+import os
+import struct
+import sys
+
+HEADER = struct.Struct('<4sIII')
+PAIR = struct.Struct('<QQ')
+# Genes are shorts in version 1 files and signed bytes from version 2
+GENE = {1: 'h', 2: 'b'}
+
+class Lineage:
+        def __init__(self, name):
+                self.name = name
+                self.f = open(name, 'rb')
+                magic, version, mem_size, self.record_size = HEADER.unpack(self.f.read(HEADER.size))
+                if magic != b'NLLG' or version not in GENE:
+                        raise ValueError('%s: not a version 1 or 2 lineage file' % name)
+                self.record = struct.Struct('<QQQI%d%s' % (mem_size, GENE[version]))
+                self.count = (os.path.getsize(name) - HEADER.size) // self.record_size
+
+        def get(self, id):
+                if id < 1 or id > self.count:
+                        return None
+                self.f.seek(HEADER.size + (id - 1) * self.record_size)
+                r = self.record.unpack(self.f.read(self.record.size))
+                return {'id': r[0], 'dad': r[1], 'mom': r[2], 'tick': r[3], 'gcode': r[4:]}
+
+        def records(self):
+                self.f.seek(HEADER.size)
+                while True:
+                        chunk = self.f.read(self.record_size * 4096)
+                        if len(chunk) < self.record_size:
+                                return
+                        for off in range(0, len(chunk) - self.record_size + 1, self.record_size):
+                                r = self.record.unpack_from(chunk, off)
+                                yield {'id': r[0], 'dad': r[1], 'mom': r[2], 'tick': r[3], 'gcode': r[4:]}
+
+        def children_index(self):
+                index = self.name + '.children'
+                if not os.path.exists(index) or os.path.getmtime(index) < os.path.getmtime(self.name):
+                        pairs = []
+                        for r in self.records():
+                                if r['dad']: pairs.append((r['dad'], r['id']))
+                                if r['mom'] and r['mom'] != r['dad']: pairs.append((r['mom'], r['id']))
+                        pairs.sort()
+                        out = open(index, 'wb')
+                        for p in pairs:
+                                out.write(PAIR.pack(*p))
+                        out.close()
+                return open(index, 'rb'), os.path.getsize(index) // PAIR.size
+
+        def children(self, id, index):
+                f, n = index
+                lo, hi = 0, n
+                while lo < hi:
+                        mid = (lo + hi) // 2
+                        f.seek(mid * PAIR.size)
+                        if PAIR.unpack(f.read(PAIR.size))[0] < id: lo = mid + 1
+                        else: hi = mid
+                kids = []
+                f.seek(lo * PAIR.size)
+                while lo < n:
+                        parent, child = PAIR.unpack(f.read(PAIR.size))
+                        if parent != id: break
+                        kids.append(child)
+                        lo += 1
+                return kids
+
+def genome_text(gcode):
+        # Same as printf("%X") of a gene in the simulator
+        return ','.join('%X' % (g & 0xffffffff) for g in gcode)
+
+if __name__ == "__main__":
+        if len(sys.argv) < 3:
+                print('usage: lineage_reader.py FILE info|genome|ancestors|descendants [ID] [DEPTH]')
+                sys.exit(1)
+        lin = Lineage(sys.argv[1])
+        cmd = sys.argv[2]
+        id = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+        depth = int(sys.argv[4]) if len(sys.argv) > 4 else 500
+        if cmd == 'info':
+                first, last = lin.get(1), lin.get(lin.count)
+                print('births', lin.count)
+                if first: print('ticks', first['tick'], '-', last['tick'])
+        elif cmd == 'genome':
+                r = lin.get(id)
+                print(genome_text(r['gcode']) if r else 'no bot %d' % id)
+        elif cmd == 'ancestors':
+                r, n = lin.get(id), 0
+                while r is not None and n < depth:
+                        print('#%i# generations up genoma# %s' % (n, genome_text(r['gcode'])))
+                        r, n = lin.get(r['dad']), n + 1
+        elif cmd == 'descendants':
+                index = lin.children_index()
+                level, n = [id], 0
+                while level and n < depth:
+                        n += 1
+                        level = [c for p in level for c in lin.children(p, index)]
+                        for c in level:
+                                r = lin.get(c)
+                                print('%i %i tick %i dad %i mom %i' % (n, c, r['tick'], r['dad'], r['mom']))
+        else:
+                print('unknown command', cmd)
+                sys.exit(1)
@@ -19,23 +19,97 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#ifndef NO_SDL
 #include <SDL.h>
+#endif
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-#define SX 1200
-#define SY 1000
-#define WIDTH 1200
-#define HEIGHT 1000
-#define BPP 4
 #define DEPTH 32
 
+// State of one world. The ensemble build (make ensemble) runs many worlds
+// at once, each on a thread of its own, so there it is thread-local; see
+// run_ensemble().
+#ifdef ENSEMBLE
+#define WORLD __thread
+#else
+#define WORLD
+#endif
+
+// Genes and VM memory cells are signed bytes. Opcodes only go up to 19, a
+// gene copied from memory (opcode 9) keeps the memory value, and memory
+// stops at -128 and 127 instead of wrapping (opcodes 3 and 4).
 #define MEM_SIZE 50
-#define MAX_AGE 2000.0
+// Loop nesting depth of the VM. Opcode 5 pushes every time it runs and
+// opcode 6 may jump back to an entry already popped, so a bot can keep
+// nesting for its whole life; it halts once the stack is this deep.
 #define MAX_LOUPS 1000
+// Loop entries kept in struct bot. Deeper ones spill to loop_spills[].
+#define LOOP_INLINE 32
 #define MAX_GENENARATION_UP_SHOW 500
 
-int last, VAR_TAX = 20;
-struct bot *bots;
+// Side of a chunk of the world, which is also a scheduling tile, in cells.
+// Bots only touch cells one step away, so tiles of the same colour in the
+// checkerboard never share a cell as long as a tile is at least 3 cells wide.
+#define CHUNK_BITS 6
+#define CHUNK (1 << CHUNK_BITS)
+
+// Positions hold the row of a cell in the top 32 bits and its column in the
+// bottom ones, so a world may have far more than 2^31 cells and finding the
+// chunk of a cell takes shifts rather than divisions.
+#define POS(x, y) ((long long)(y) << 32 | (x))
+#define POS_X(p) ((int)((p) & 0xffffffff))
+#define POS_Y(p) ((int)((p) >> 32))
+
+// Bots live in a pool of slots and are referred to by 32-bit handles: the
+// low bits index the slot and the top byte is the slot generation, bumped
+// every time the slot is freed, so a handle to a dead bot never resolves to
+// whoever reuses its slot. Handle 0 is never issued and means "no bot".
+#define SLOT_BITS 24
+#define SLOT_MASK ((1 << SLOT_BITS) - 1)
+#define MAX_SLOTS (1 << SLOT_BITS)
+#define POOL_START (1 << 16)
+#define NO_BOT 0
+
+// The world and its rules, set at startup (--size, --wrap, --food,
+// --mutation, --max-age). The window is the size of the world.
+int sx = 1200, sy = 1000;
+int wrap = 0; // the world is a torus
+WORLD int strip_y0 = 0, strip_y1 = 0; // rows of this process, all of them unless --procs
+WORLD float max_age = 2000.0;
+
+WORLD int last, VAR_TAX = 20; // mutations per 1000 copied opcodes
+WORLD int food = 40; // chance in 100 of another food bot per tick
+WORLD struct bot *bots; // slot pool, see SLOT_BITS
+
+// Run state shared by the main loop, the event handler and the signal handler
+volatile sig_atomic_t keypress = 0;
+volatile sig_atomic_t show_stats = 0; // S key or SIGUSR1
+int headless = 0;
+short view = 0, get = 0;
+signed char selected[MEM_SIZE];
+int selected_version = 1; // bumped whenever "selected" changes
+WORLD long births = 0, deaths = 0;
+WORLD int tick = 0;
+int slice = 1; // --slice, instructions a bot may run per tick
+// Best bot for the G key and data.txt: its handle, since sweep_dead reorders
+// live[], and the energy that made it the best
+WORLD unsigned int best = NO_BOT;
+WORLD long long best_energy = 0;
 
 /*
 0x0 - ptr++
@@ -64,27 +138,176 @@ struct bot *bots;
 
 struct bot
 {
-  int p;
-  int lp; // Last position
+  long long p; // see POS()
+  long long lp; // Last position
   float energy;
-  short gcode[MEM_SIZE];
-  short memory[MEM_SIZE];
-  short new_gcode[MEM_SIZE];
-  long int nl;
-  short loops[MAX_LOUPS];
-  short loops_ptr[MAX_LOUPS];
+  int genome; // id in the genome table, see intern_genome()
+  int species; // that genome's species, kept here for the sweep
+  signed char memory[MEM_SIZE + 2]; // ptr may stop one past the genome, like pos
+  signed char new_gcode[MEM_SIZE];
+  short nl;
+  short spilled; // loop entries past LOOP_INLINE this bot has used, see grow_loops()
+  unsigned char loops[LOOP_INLINE][2]; // pos and ptr, both within HALT_POS
   short ptr;
   short pos;
   short dir;
-  short r;
-  short g;
-  short b;
   int age;
   short generation;
   int last_adr;
-  struct bot *dad;
+  unsigned int dad; // handle of the parent, see resolve()
+  unsigned int mom; // handle of the partner of a sexual birth (opcode 15)
+  unsigned long long id; // lineage id, see record_birth()
+  int birth; // tick of birth
+  unsigned int self; // own handle, NO_BOT while the slot is free
+  unsigned char gen; // generation of the slot
+  unsigned long long rng; // private random stream, see rng_next()
+};
+
+// A genome is decoded once when interned and compute() runs the decoded form.
+// Every position gets an entry, since loops may jump back anywhere. Runs of
+// the same pointer or memory step are fused into one entry counting them,
+// genes that are not opcodes become OP_NOP, and the entry past the end is
+// OP_HALT, which is also where a bot is sent when its pointer or loop stack
+// goes out of range. That way compute() does no bounds checks of its own.
+#define OP_NOP 0
+#define OP_HALT 20
+#define HALT_POS (MEM_SIZE + 2)
+
+struct op
+{
+  unsigned char kind; // opcode 1 - 19, OP_NOP or OP_HALT
+  unsigned char n; // instructions it stands for, more than 1 for fused runs
+  unsigned char next; // pos after it
+};
+
+// Built with -DVM_STATS, every worker counts what the interpreter does, and
+// the counts are printed with the phase timers, see print_phase_times().
+// Without it the VM_STAT macros are empty.
+#ifdef VM_STATS
+struct vm_stats
+{
+  long long executed[OP_HALT + 1]; // instructions by opcode
+  long long ok[OP_HALT + 1]; // did what they were meant to, see print_vm_stats()
+  long long halted[OP_HALT + 1]; // stopped the bot instead (opcodes 1, 2 and 5)
+  long long sensed[3]; // results of opcode 7: nothing, other, compatible
+};
+#define VM_STAT(w, counter) ((w)->stats.counter++)
+#define VM_STAT_ADD(w, counter, n) ((w)->stats.counter += (n))
+#else
+#define VM_STAT(w, counter) ((void)0)
+#define VM_STAT_ADD(w, counter, n) ((void)0)
+#endif
+
+// A tick engine thread. Before a phase it takes one free slot for every bot
+// in its slice (a bot gives at most one birth per instruction), so births
+// never touch the shared free list and are never refused. The slots used
+// are appended to the live list once the phase is over.
+struct worker
+{
+  pthread_t thread;
+  int from, to; // slice of tile_bots run in the current phase
+  int *reserve, nreserve;
+  int *born, nborn;
+  int cap;
+  long long instructions; // run so far, for --bench
+#ifdef VM_STATS
+  struct vm_stats stats;
+#endif
+};
+
+int threads = 1, quit_workers = 0;
+WORLD int tiles_x, tiles_y, colors_x, colors;
+WORLD int *tile_bots, tile_bots_cap = 0;
+WORLD int *chunk_start, chunk_start_cap = 0; // first bot of every chunk in tile_bots, in scheduling order
+WORLD int color_start[10]; // first chunk of each of up to 3 x 3 colours
+WORLD struct worker *workers;
+WORLD int pool_cap = 0, nfree = 0;
+WORLD int *free_slots; // stack of free slot indices
+WORLD int *live; // slot indices of the living bots, "last" of them
+// Genomes are interned: every distinct genome alive is stored once with the
+// number of living bots carrying it, and with whatever is derived from the
+// genome alone. Entries live in pages that never move, so ids can be
+// dereferenced without the lock while other threads intern new genomes.
+#define GENOME_PAGE_BITS 12
+#define GENOME_PAGE (1 << GENOME_PAGE_BITS)
+#define MAX_GENOME_PAGES (MAX_SLOTS / GENOME_PAGE) // never more genomes than bots
+
+struct genome
+{
+  signed char gcode[MEM_SIZE + 2]; // the two cells past the end read as no-ops
+  struct op code[HALT_POS + 1];
+  unsigned int hash;
+  int refs; // living bots with this genome, 0 while the entry is free
+  int next; // next entry in the hash chain or in the free list
+  short r, g, b; // colour, from the last 9 genes
+  float comp; // compatibility() with "selected", for the compatibility view
+  int comp_version; // selected_version comp was worked out for
+  int species; // entry in the species table, see assign_species()
+};
+
+WORLD struct genome *genome_pages[MAX_GENOME_PAGES];
+WORLD int genome_top = 1; // entries handed out so far, id 0 means no genome
+WORLD int genome_free = 0; // free list of entries
+WORLD int genome_count = 0; // distinct genomes alive
+WORLD int *genome_buckets, genome_nbuckets = 0;
+WORLD pthread_mutex_t genome_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Species are clusters of genomes, formed as genomes are interned. A new
+// genome gets a minhash signature over its (position, gene) pairs, cut into
+// bands of rows, and joins the oldest living species that one of its bands
+// matches; two genomes share a band with a chance that climbs steeply with
+// the genes they share (about 1 for one mutation apart, 0.6 for 10, 0.05 for
+// 25). A genome that matches none founds a species under its own bands. The
+// table changes under genome_lock; its stats only between phases.
+#define SPECIES_BANDS 4
+#define SPECIES_ROWS 4
+#define TOP_SPECIES 8 // in each telemetry record
+
+struct species
+{
+  unsigned int label; // never reused, 0 while the entry is free
+  int genomes; // genomes alive in it
+  int population; // bots, as of the last sweep
+  float energy; // of its bots, as of the last sweep
+  int births, deaths; // since the last telemetry record
+  unsigned long long band[SPECIES_BANDS]; // of the founder
+  int next[SPECIES_BANDS]; // band hash chains, see species_buckets
+};
+
+WORLD struct species *species;
+WORLD int species_top = 0, species_cap = 0; // entries handed out so far, allocated
+WORLD int species_free = -1; // free list of entries, through next[0]
+WORLD int species_count = 0; // species alive
+WORLD unsigned int species_labels = 0; // labels handed out so far
+// Chains of bands with the same hash; a link is species * SPECIES_BANDS + band + 1
+WORLD int *species_buckets, species_nbuckets = 0;
+
+FILE *lineage; // --lineage output, NULL when disabled
+WORLD unsigned long long next_id = 1;
+
+// Lineage file: a header and then one fixed-size record per birth, in birth
+// order. Ids are handed out densely from 1, so bot n is record n - 1 and the
+// file is its own index for ancestor walks; see lineage_reader.py.
+#define LINEAGE_VERSION 2
+
+struct lineage_header
+{
+  char magic[4]; // "NLLG"
+  unsigned int version;
+  unsigned int mem_size;
+  unsigned int record_size;
 };
 
+struct lineage_record
+{
+  unsigned long long id;
+  unsigned long long dad, mom; // 0 when there is no such parent
+  unsigned int tick;
+  signed char gcode[MEM_SIZE];
+};
+WORLD unsigned long long world_rng; // stream for the food spawner
+pthread_barrier_t phase_start, phase_done;
+
 char *itoa(int value, char *str, int radix)
 {
   static char dig[] = "0123456789"
@@ -114,900 +337,4251 @@ char *itoa(int value, char *str, int radix)
   return str;
 }
 
-void set_bot(struct bot *b, struct bot *dad, int p, float e, short *g, struct bot **lb, short gen) {
-  short i;
-  int cr, cg, cb;
+struct genome *genome_at(int id)
+{
+  return &genome_pages[id >> GENOME_PAGE_BITS][id & (GENOME_PAGE - 1)];
+}
 
-  if (dad != NULL) {
-    // Perform additional checks if needed, for example:
-    // Check if dad is within the bots array bounds if applicable.
-    b->dad = dad;
-  } else {
-    b->dad = NULL; // or handle the case appropriately
+signed char *gcode_of(struct bot *b)
+{
+  return genome_at(b->genome)->gcode;
+}
+
+// Eight genes at a time, each word mixed in with a multiply and a fold
+unsigned int hash_genome(signed char *g)
+{
+  unsigned long long h = 14695981039346656037ULL, w;
+  int i;
+  for (i = 0; i + 8 <= MEM_SIZE; i += 8)
+  {
+    memcpy(&w, g + i, 8);
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 32;
   }
-  // Reset or initialize all fields to ensure no data carries over from a previous usage of this bot slot
-  b->p = p;
-  b->lp = 0; // Assuming lp is meant to be reset. If it should inherit from dad or have a specific initial value, adjust this accordingly.
-  b->energy = e;
-  b->age = MAX_AGE;
-  b->generation = gen + 1;
-  b->nl = 0;
-  memset(b->loops, 0, sizeof(b->loops));
-  memset(b->loops_ptr, 0, sizeof(b->loops_ptr));
-  b->ptr = 0;
-  b->pos = 0;
-  b->dir = rand() % 4; // Random direction
-  b->last_adr = 0;
+  for (; i < MEM_SIZE; i++)
+    h = (h ^ (unsigned char)g[i]) * 1099511628211ULL;
+  return h ^ h >> 32;
+}
 
-  // Clear memory and new_gcode arrays
-  memset(b->memory, 0, sizeof(b->memory));
-  memset(b->new_gcode, 0, sizeof(b->new_gcode));
+// Called with genome_lock held
+void grow_genome_buckets(void)
+{
+  int id, n = genome_nbuckets ? genome_nbuckets * 2 : 1024;
+  struct genome *e;
+
+  genome_buckets = (int *)realloc(genome_buckets, sizeof(int) * n);
+  memset(genome_buckets, 0, sizeof(int) * n);
+  genome_nbuckets = n;
+  for (id = 1; id < genome_top; id++)
+  {
+    e = genome_at(id);
+    if (e->refs > 0)
+    {
+      e->next = genome_buckets[e->hash & (n - 1)];
+      genome_buckets[e->hash & (n - 1)] = id;
+    }
+  }
+}
+
+// Fills in everything derived from e->gcode: the decoded form and the colour
+void decode_genome(struct genome *e)
+{
+  signed char *g = e->gcode;
+  int i, n, cr, cg, cb;
+  struct op *op;
 
-  // Copy genetic code from parent or initialization array
-  for (i = 0; i < MEM_SIZE; i++) {
-    b->gcode[i] = g[i];
+  for (i = 0; i < HALT_POS; i++)
+  {
+    op = &e->code[i];
+    op->kind = e->gcode[i] > 0 && e->gcode[i] < OP_HALT ? e->gcode[i] : OP_NOP;
+    n = 1;
+    if (op->kind >= 1 && op->kind <= 4)
+      while (i + n < HALT_POS && e->gcode[i + n] == e->gcode[i])
+        n++;
+    op->n = n;
+    op->next = i + n;
   }
+  e->code[HALT_POS].kind = OP_HALT;
+  e->code[HALT_POS].n = 1;
+  e->code[HALT_POS].next = HALT_POS;
 
   // Calculate color based on genetic code
   cr = ((g[MEM_SIZE - 9] + g[MEM_SIZE - 8] + g[MEM_SIZE - 7]) / 57.0) * 255;
   cg = ((g[MEM_SIZE - 6] + g[MEM_SIZE - 5] + g[MEM_SIZE - 4]) / 57.0) * 255;
   cb = ((g[MEM_SIZE - 3] + g[MEM_SIZE - 2] + g[MEM_SIZE - 1]) / 57.0) * 255;
-  b->r = cr > 255 ? 255 : cr;
-  b->g = cg > 255 ? 255 : cg;
-  b->b = cb > 255 ? 255 : cb;
+  e->r = cr > 255 ? 255 : cr;
+  e->g = cg > 255 ? 255 : cg;
+  e->b = cb > 255 ? 255 : cb;
 }
 
-char compatible(struct bot *b1, struct bot *b2)
+unsigned int minhash(unsigned int x)
 {
-  if (b1 == NULL || b2 == NULL)
-    return 0;
-  int i, pos;
-  for (i = 0; i < 5; i++)
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  return x ^ x >> 16;
+}
+
+// The bands of g's minhash signature, each a hash of SPECIES_ROWS minima
+void species_bands(signed char *g, unsigned long long *band)
+{
+  unsigned int m[SPECIES_BANDS * SPECIES_ROWS], h, x;
+  int i, k;
+
+  memset(m, 0xff, sizeof(m));
+  for (i = 0; i < MEM_SIZE; i++)
   {
-    pos = rand() % 9 + 1;
-    if (b1->gcode[MEM_SIZE - pos] != b2->gcode[MEM_SIZE - pos])
-      return (0);
+    x = ((unsigned int)i << 8 | (unsigned char)g[i]) * 0x9E3779B1u;
+    for (k = 0; k < SPECIES_BANDS * SPECIES_ROWS; k++)
+      if ((h = minhash(x ^ k * 0x85EBCA6Bu)) < m[k])
+        m[k] = h;
+  }
+  for (i = 0; i < SPECIES_BANDS; i++)
+  {
+    band[i] = i;
+    for (k = 0; k < SPECIES_ROWS; k++)
+      band[i] = (band[i] ^ m[i * SPECIES_ROWS + k]) * 0x100000001B3ULL;
   }
-  return (1);
 }
 
-float compatibility(short *gcode, struct bot *b)
+static inline int species_bucket(unsigned long long band)
 {
-  int i;
-  float val = 0;
-  for (i = 0; i < MEM_SIZE; i++)
+  return (band ^ band >> 29) & (species_nbuckets - 1);
+}
+
+void link_species(int s)
+{
+  int b, *head;
+  for (b = 0; b < SPECIES_BANDS; b++)
+  {
+    head = &species_buckets[species_bucket(species[s].band[b])];
+    species[s].next[b] = *head;
+    *head = s * SPECIES_BANDS + b + 1;
+  }
+}
+
+void unlink_species(int s)
+{
+  int b, *link;
+  for (b = 0; b < SPECIES_BANDS; b++)
+  {
+    for (link = &species_buckets[species_bucket(species[s].band[b])]; *link != s * SPECIES_BANDS + b + 1;
+         link = &species[(*link - 1) / SPECIES_BANDS].next[(*link - 1) % SPECIES_BANDS])
+      ;
+    *link = species[s].next[b];
+  }
+}
+
+void grow_species_buckets(void)
+{
+  int s, n = species_nbuckets ? species_nbuckets * 2 : 1024;
+
+  species_buckets = (int *)realloc(species_buckets, sizeof(int) * n);
+  memset(species_buckets, 0, sizeof(int) * n);
+  species_nbuckets = n;
+  for (s = 0; s < species_top; s++)
+    if (species[s].label)
+      link_species(s);
+}
+
+// Species of a new genome with the given species_bands(), which is counted
+// in it. Called with genome_lock held.
+int assign_species(unsigned long long *band)
+{
+  struct species *c;
+  int b, l, s = -1;
+
+  // The oldest match, so the choice does not depend on the order of the chains
+  for (b = 0; b < SPECIES_BANDS && species_nbuckets; b++)
+    for (l = species_buckets[species_bucket(band[b])]; l; l = c->next[(l - 1) % SPECIES_BANDS])
+    {
+      c = &species[(l - 1) / SPECIES_BANDS];
+      if ((l - 1) % SPECIES_BANDS == b && c->band[b] == band[b] && (s < 0 || c->label < species[s].label))
+        s = c - species;
+    }
+  if (s >= 0)
+  {
+    species[s].genomes++;
+    return s;
+  }
+
+  if (species_count * 2 * SPECIES_BANDS >= species_nbuckets)
+    grow_species_buckets();
+  if (species_free >= 0)
+  {
+    s = species_free;
+    species_free = species[s].next[0];
+  }
+  else
   {
-    if (gcode[i] == b->gcode[i])
-      val += 1;
+    if (species_top == species_cap)
+    {
+      species_cap = species_cap ? species_cap * 2 : 1024;
+      species = (struct species *)realloc(species, sizeof(struct species) * species_cap);
+    }
+    s = species_top++;
   }
-  return (val / MEM_SIZE);
+  memset(&species[s], 0, sizeof(struct species));
+  species[s].label = ++species_labels;
+  species[s].genomes = 1;
+  memcpy(species[s].band, band, sizeof(species[s].band));
+  link_species(s);
+  ++species_count;
+  return s;
 }
 
-void compute(struct bot *b, struct bot **lb)
+// Called when genome entry leaves species s
+void leave_species(int s)
 {
-  --b->energy;
-  short ngcode[MEM_SIZE];
-  int mean, index = MEM_SIZE / 2, i;
-  --b->age;
-  if (b->pos - 1 > MEM_SIZE || b->ptr - 1 > MEM_SIZE || b->ptr < 0 || b->nl > MAX_LOUPS)
+  if (--species[s].genomes > 0)
     return;
-  switch (b->gcode[b->pos++])
+  unlink_species(s);
+  species[s].label = 0;
+  species[s].next[0] = species_free;
+  species_free = s;
+  --species_count;
+}
+
+struct species *species_of(struct bot *b)
+{
+  return &species[b->species];
+}
+
+// The n biggest species alive, biggest first, oldest first among equals.
+// Returns how many there are, up to n.
+int top_species(int *top, int n)
+{
+  int s, i, k = 0;
+  struct species *c;
+
+  for (s = 0; s < species_top; s++)
   {
-    case 1:
-      b->ptr++;
-      break;
-    case 2:
-      b->ptr--;
-      break;
-    case 3:
-      b->memory[b->ptr]++;
-      break;
-    case 4:
-      b->memory[b->ptr]--;
-      break;
-    case 5:
-      if (b->memory[b->ptr])
-        b->loops[b->nl] = b->pos;
-      b->loops_ptr[b->nl++] = b->ptr;
-      break;
-    case 6:
-      if (b->nl && b->memory[b->loops_ptr[b->nl - 1]] <= 0)
-      {
-        b->pos = b->loops[b->nl - 1];
-      }
-      else if (b->nl)
-      {
-        --b->nl;
-      }
-      break;
-    case 7:
-      switch (b->dir)
-      {
-        case 0:
-          if (b->p + 1 < SX * SY && lb[b->p + 1] != NULL)
-          {
-            if (compatible(lb[b->p + 1], b))
-            {
-              b->memory[b->ptr] = 2;
-            }
-            else
-            {
-              b->memory[b->ptr] = 1;
-            }
-          }
-          else
-          {
-            b->memory[b->ptr] = 0;
-          }
-          break;
-        case 1:
-          if (b->p - SX >= 0 && lb[b->p - SX] != NULL)
-          {
-            if (compatible(lb[b->p - SX], b))
-            {
-              b->memory[b->ptr] = 2;
-            }
-            else
-            {
-              b->memory[b->ptr] = 1;
-            }
-          }
-          else
-          {
-            b->memory[b->ptr] = 0;
-          }
-          break;
-        case 2:
-          if (b->p - 1 >= 0 && lb[b->p - 1] != NULL)
-          {
-            if (compatible(lb[b->p - 1], b))
-            {
-              b->memory[b->ptr] = 2;
-            }
-            else
-            {
-              b->memory[b->ptr] = 1;
-            }
-          }
-          else
-          {
-            b->memory[b->ptr] = 0;
-          }
-          break;
-        case 3:
-          if (b->p + SX < SX * SY && lb[b->p + SX] != NULL)
-          {
-            if (compatible(lb[b->p + SX], b))
-            {
-              b->memory[b->ptr] = 2;
-            }
-            else
-            {
-              b->memory[b->ptr] = 1;
-            }
-          }
-          else
-          {
-            b->memory[b->ptr] = 0;
-          }
-          break;
-      }
-      break;
-    case 8:
-      b->memory[b->ptr] = b->dir;
-      break;
-    case 9:
-      if (b->last_adr < MEM_SIZE)
-        b->new_gcode[b->last_adr++] = b->memory[b->ptr];
-      break;
-    case 10:
-      switch (b->dir)
-      {
-        case 0:
-          b->dir = 1;
-          break;
-        case 1:
-          b->dir = 2;
-          break;
-        case 2:
-          b->dir = 3;
-          break;
-        case 3:
-          b->dir = 0;
-          break;
-      }
-      break;
-    case 11:
-      switch (b->dir)
-      {
-        case 0:
-          b->dir = 3;
-          break;
-        case 1:
-          b->dir = 0;
-          break;
-        case 2:
-          b->dir = 1;
-          break;
-        case 3:
-          b->dir = 2;
-          break;
-      }
-      break;
-    case 12:
-      // b->energy -= 40;
-      switch (b->dir)
-      {
-        case 0:
-          if (b->p + 1 < SX * SY && lb[b->p + 1] == NULL)
-          {
-            lb[b->p + 1] = b;
-            b->p = b->p + 1;
-          }
-          break;
-        case 1:
-          if (b->p - SX >= 0 && lb[b->p - SX] == NULL)
-          {
-            lb[b->p - SX] = b;
-            b->p = b->p - SX;
-          }
-          break;
-        case 2:
-          if (b->p - 1 >= 0 && lb[b->p - 1] == NULL)
-          {
-            lb[b->p - 1] = b;
-            b->p = b->p - 1;
-          }
-          break;
-        case 3:
-          if (b->p + SX < SX * SY && lb[b->p + SX] == NULL)
-          {
-            lb[b->p + SX] = b;
-            b->p = b->p + SX;
-          }
-          break;
+    c = &species[s];
+    if (!c->label)
+      continue;
+    for (i = k; i > 0 && (species[top[i - 1]].population < c->population ||
+                          (species[top[i - 1]].population == c->population && species[top[i - 1]].label > c->label));
+         i--)
+      if (i < n)
+        top[i] = top[i - 1];
+    if (i < n)
+    {
+      top[i] = s;
+      if (k < n)
+        k++;
+    }
+  }
+  return k;
+}
+
+// Id of genome g with hash h, or 0 if it is not in the table. Called with
+// genome_lock held.
+int find_genome(signed char *g, unsigned int h)
+{
+  int id;
+  struct genome *e;
+
+  for (id = genome_nbuckets ? genome_buckets[h & (genome_nbuckets - 1)] : 0; id; id = e->next)
+  {
+    e = genome_at(id);
+    if (e->hash == h && !memcmp(e->gcode, g, MEM_SIZE))
+      return id;
+  }
+  return 0;
+}
+
+// Id of genome g with one more reference, adding it to the table if new
+int intern_genome(signed char *g)
+{
+  unsigned int h = hash_genome(g);
+  unsigned long long band[SPECIES_BANDS];
+  int id;
+  struct genome *e;
+
+  pthread_mutex_lock(&genome_lock);
+  if ((id = find_genome(g, h)) == 0)
+  {
+    // A new genome's species bands are worked out without holding up the
+    // other threads, which may add the same genome meanwhile
+    pthread_mutex_unlock(&genome_lock);
+    species_bands(g, band);
+    pthread_mutex_lock(&genome_lock);
+    id = find_genome(g, h);
+  }
+  if (id)
+  {
+    __sync_fetch_and_add(&genome_at(id)->refs, 1);
+    pthread_mutex_unlock(&genome_lock);
+    return id;
+  }
+
+  if (genome_count >= genome_nbuckets)
+    grow_genome_buckets();
+  if (genome_free)
+  {
+    id = genome_free;
+    genome_free = genome_at(id)->next;
+  }
+  else
+  {
+    id = genome_top++;
+    if (genome_pages[id >> GENOME_PAGE_BITS] == NULL)
+      genome_pages[id >> GENOME_PAGE_BITS] = (struct genome *)calloc(GENOME_PAGE, sizeof(struct genome));
+  }
+  e = genome_at(id);
+  memcpy(e->gcode, g, MEM_SIZE);
+  e->gcode[MEM_SIZE] = e->gcode[MEM_SIZE + 1] = 0;
+  e->hash = h;
+  e->refs = 1;
+  decode_genome(e);
+  e->species = assign_species(band);
+
+  e->next = genome_buckets[h & (genome_nbuckets - 1)];
+  genome_buckets[h & (genome_nbuckets - 1)] = id;
+  ++genome_count;
+  pthread_mutex_unlock(&genome_lock);
+  return id;
+}
+
+// Drop one reference. Only called from the death sweep, outside of phases.
+void release_genome(int id)
+{
+  struct genome *e = genome_at(id);
+  int *link;
+
+  if (--e->refs > 0)
+    return;
+  for (link = &genome_buckets[e->hash & (genome_nbuckets - 1)]; *link != id; link = &genome_at(*link)->next)
+    ;
+  *link = e->next;
+  e->next = genome_free;
+  genome_free = id;
+  --genome_count;
+  leave_species(e->species);
+}
+
+// Bot behind a handle, or NULL if that bot has died since
+struct bot *resolve(unsigned int h)
+{
+  struct bot *b;
+  if (h == NO_BOT || (h & SLOT_MASK) >= pool_cap)
+    return NULL;
+  b = &bots[h & SLOT_MASK];
+  return b->self == h ? b : NULL;
+}
+
+// The occupancy grid is kept in chunks of CHUNK x CHUNK cells. A chunk is
+// allocated when a bot first lands in it and goes back to a pool when the
+// sweep finds it empty, so memory and the work of a tick follow the
+// populated area rather than the size of the world. Chunks are also the
+// scheduling tiles of the checkerboard.
+struct chunk
+{
+  unsigned int cell[CHUNK * CHUNK]; // handle of the bot in every cell
+  int bots; // cells in use, changed atomically: bots of two tiles of a colour may both reach in
+  long long index; // in chunk_dir
+  unsigned long long key; // scheduling order, see chunk_key()
+  int n; // this tick's bots, then where the next one goes in tile_bots
+  struct chunk *next_free;
+};
+
+WORLD struct chunk **chunk_dir; // chunks_x * chunks_y, NULL where there is no bot
+WORLD long long chunks_x, chunks_y;
+WORLD struct chunk **active; // every allocated chunk
+WORLD int nactive = 0, active_cap = 0;
+WORLD struct chunk *chunk_pool = NULL;
+WORLD pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Column colour of a tile. Positions run on from the end of one row to the
+// start of the next, so the first and last tile columns are neighbours too:
+// the last column gets a third colour.
+int tile_color_x(int tx)
+{
+  if (tiles_x >= 3 && tx == tiles_x - 1)
+    return 2;
+  return tx % 2;
+}
+
+// Row colour of a tile. The first and last rows only touch on a torus, and
+// then need a third colour when there is an odd number of rows.
+int tile_color_y(int ty)
+{
+  if (wrap && tiles_y >= 3 && tiles_y % 2 && ty == tiles_y - 1)
+    return 2;
+  return ty % 2;
+}
+
+// Sets up an empty world of sx x sy cells. A chunk only partly inside the
+// world is folded into the tile before it, so every tile is at least CHUNK
+// cells across.
+void init_world(void)
+{
+  free(chunk_dir);
+  chunks_x = (sx + CHUNK - 1) >> CHUNK_BITS;
+  chunks_y = (sy + CHUNK - 1) >> CHUNK_BITS;
+  chunk_dir = (struct chunk **)calloc(chunks_x * chunks_y, sizeof(struct chunk *));
+  tiles_x = sx / CHUNK > 0 ? sx / CHUNK : 1;
+  tiles_y = sy / CHUNK > 0 ? sy / CHUNK : 1;
+  colors_x = tiles_x >= 3 ? 3 : tiles_x;
+  colors = colors_x * (wrap && tiles_y >= 3 && tiles_y % 2 ? 3 : 2);
+  strip_y0 = 0;
+  strip_y1 = sy;
+}
+
+// Chunks run by colour of their tile, then tile row and column, then
+// position within a folded tile; the low two bits are that position. Tile
+// rows and columns take 26 bits each, more than world_size_ok() allows.
+unsigned long long chunk_key(long long d)
+{
+  int cx = d % chunks_x, cy = d / chunks_x;
+  int tx = cx < tiles_x ? cx : tiles_x - 1, ty = cy < tiles_y ? cy : tiles_y - 1;
+  int c = tile_color_y(ty) * colors_x + tile_color_x(tx);
+
+  return (unsigned long long)c << 60 | (unsigned long long)ty << 28 | (unsigned long long)tx << 2 | (cy - ty) << 1 | (cx - tx);
+}
+
+static inline long long chunk_index(long long p)
+{
+  return (long long)(POS_Y(p) >> CHUNK_BITS) * chunks_x + (POS_X(p) >> CHUNK_BITS);
+}
+
+static inline int cell_offset(long long p)
+{
+  return (POS_Y(p) & (CHUNK - 1)) << CHUNK_BITS | (POS_X(p) & (CHUNK - 1));
+}
+
+// Chunk holding cell p, or NULL if it has no bots
+static inline struct chunk *chunk_of(long long p)
+{
+  return __atomic_load_n(&chunk_dir[chunk_index(p)], __ATOMIC_ACQUIRE);
+}
+
+// Allocates the chunk holding cell p. Workers may get here at the same
+// time for the same chunk, so the lookup is repeated under the lock.
+struct chunk *claim_chunk(long long p)
+{
+  long long d = chunk_index(p);
+  struct chunk *c;
+
+  pthread_mutex_lock(&chunk_lock);
+  if ((c = chunk_dir[d]) == NULL)
+  {
+    if ((c = chunk_pool) != NULL)
+      chunk_pool = c->next_free;
+    else
+      c = (struct chunk *)calloc(1, sizeof(struct chunk));
+    c->index = d;
+    c->key = chunk_key(d);
+    if (nactive == active_cap)
+    {
+      active_cap = active_cap ? active_cap * 2 : 1024;
+      active = (struct chunk **)realloc(active, sizeof(struct chunk *) * active_cap);
+    }
+    active[nactive++] = c;
+    __atomic_store_n(&chunk_dir[d], c, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&chunk_lock);
+  return c;
+}
+
+// Handle of the bot in cell p, or NO_BOT
+static inline unsigned int cell(long long p)
+{
+  struct chunk *c = chunk_of(p);
+  return c == NULL ? NO_BOT : c->cell[cell_offset(p)];
+}
+
+void set_cell(long long p, unsigned int h)
+{
+  struct chunk *c = chunk_of(p);
+  unsigned int *x;
+
+  if (c == NULL)
+  {
+    if (h == NO_BOT)
+      return;
+    c = claim_chunk(p);
+  }
+  x = &c->cell[cell_offset(p)];
+  if ((*x == NO_BOT) != (h == NO_BOT))
+    __atomic_add_fetch(&c->bots, h == NO_BOT ? -1 : 1, __ATOMIC_RELAXED);
+  *x = h;
+}
+
+// Moves handle h from cell p to the empty cell q. Most moves stay inside a
+// chunk and leave its count alone.
+void move_cell(long long p, long long q, unsigned int h)
+{
+  struct chunk *c = chunk_of(p);
+
+  if (c == chunk_of(q))
+  {
+    c->cell[cell_offset(p)] = NO_BOT;
+    c->cell[cell_offset(q)] = h;
+    return;
+  }
+  set_cell(p, NO_BOT);
+  set_cell(q, h);
+}
+
+// Gives the chunks left without bots back to the pool; their cells are all
+// NO_BOT already. Only called between ticks.
+void release_chunks(void)
+{
+  int i, n = 0;
+
+  for (i = 0; i < nactive; i++)
+    if (active[i]->bots == 0)
+    {
+      chunk_dir[active[i]->index] = NULL;
+      active[i]->next_free = chunk_pool;
+      chunk_pool = active[i];
+    }
+    else
+      active[n++] = active[i];
+  nactive = n;
+}
+
+// Whether cell p is in the rows this process runs, see --procs
+static inline int owns(long long p)
+{
+  return POS_Y(p) >= strip_y0 && POS_Y(p) < strip_y1;
+}
+
+// Bot in a cell. The grid only ever holds living bots, so no generation check.
+struct bot *at(long long p)
+{
+  unsigned int h = cell(p);
+  return h == NO_BOT ? NULL : &bots[h & SLOT_MASK];
+}
+
+// Loop stack entries past LOOP_INLINE, one per slot. The storage stays with
+// the slot when its bot dies, so only the first bot in a slot to nest that
+// deep pays for it.
+struct loop_spill
+{
+  unsigned char (*loops)[2];
+  int cap;
+};
+WORLD struct loop_spill *loop_spills = NULL;
+
+// Make sure at least n slots are free, growing the pool if needed. Only
+// called between phases: growing moves bots[], but handles stay valid.
+int reserve_slots(int n)
+{
+  int cap = pool_cap, i;
+
+  if (nfree >= n)
+    return 1;
+  while (cap - pool_cap + nfree < n && cap < MAX_SLOTS)
+    cap = cap ? cap * 2 : POOL_START;
+  if (cap > MAX_SLOTS)
+    cap = MAX_SLOTS;
+  if (cap == pool_cap)
+    return 0;
+  bots = (struct bot *)realloc(bots, sizeof(struct bot) * cap);
+  free_slots = (int *)realloc(free_slots, sizeof(int) * cap);
+  live = (int *)realloc(live, sizeof(int) * cap);
+  loop_spills = (struct loop_spill *)realloc(loop_spills, sizeof(struct loop_spill) * cap);
+  memset(bots + pool_cap, 0, sizeof(struct bot) * (cap - pool_cap));
+  memset(loop_spills + pool_cap, 0, sizeof(struct loop_spill) * (cap - pool_cap));
+  memset(live + pool_cap, 0, sizeof(int) * (cap - pool_cap));
+  // Highest first, so that low slots are handed out first
+  for (i = cap - 1; i >= pool_cap; i--)
+    free_slots[nfree++] = i;
+  pool_cap = cap;
+  return nfree >= n;
+}
+
+// Give a free slot a fresh handle
+struct bot *claim_slot(int i)
+{
+  struct bot *b = &bots[i];
+  b->gen = b->gen % 255 + 1;
+  b->self = (unsigned int)b->gen << SLOT_BITS | i;
+  return b;
+}
+
+// Take a slot for a bot born outside of a phase, or NULL if the pool is full
+struct bot *new_bot(void)
+{
+  if (!reserve_slots(1))
+    return NULL;
+  return claim_slot(free_slots[--nfree]);
+}
+
+// Make room for n spilled loop entries in slot i, or return 0
+int reserve_loops(int i, int n)
+{
+  struct loop_spill *l = &loop_spills[i];
+  unsigned char (*loops)[2];
+  int cap = l->cap;
+
+  if (n <= cap)
+    return 1;
+  while (cap < n)
+    cap = cap ? cap * 2 : LOOP_INLINE;
+  if ((loops = realloc(l->loops, sizeof(*loops) * cap)) == NULL)
+    return 0;
+  l->loops = loops;
+  l->cap = cap;
+  return 1;
+}
+
+// Entry k of the loop stack of b: the pos to jump back to and the ptr to test
+static inline unsigned char *loop_at(struct bot *b, int k)
+{
+  return k < LOOP_INLINE ? b->loops[k] : loop_spills[b->self & SLOT_MASK].loops[k - LOOP_INLINE];
+}
+
+// Make room for the next push on b's loop stack, or return 0. Entries this
+// bot has not used yet start zeroed, like the inline ones after set_bot().
+int grow_loops(struct bot *b)
+{
+  int k = b->nl - LOOP_INLINE;
+
+  if (k < b->spilled)
+    return 1;
+  if (!reserve_loops(b->self & SLOT_MASK, k + 1))
+    return 0;
+  memset(loop_spills[b->self & SLOT_MASK].loops[k], 0, 2);
+  b->spilled = k + 1;
+  return 1;
+}
+
+void free_bot(struct bot *b)
+{
+  release_genome(b->genome);
+  free_slots[nfree++] = b->self & SLOT_MASK;
+  b->self = NO_BOT;
+}
+
+// splitmix64. Every bot carries its own counter, so draws do not depend on
+// which thread runs the bot or in what order, and runs are reproducible from
+// the seed alone at any thread count.
+unsigned int rng_next(unsigned long long *s)
+{
+  unsigned long long z = (*s += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return (z ^ (z >> 31)) >> 32;
+}
+
+// Uniform integer in [0, n)
+int rng_below(unsigned long long *s, int n)
+{
+  return ((unsigned long long)rng_next(s) * n) >> 32;
+}
+
+// Seed for a new stream drawn from an existing one
+unsigned long long rng_split(unsigned long long *s)
+{
+  unsigned long long hi = rng_next(s);
+  return hi << 32 | rng_next(s);
+}
+
+void set_bot(struct bot *b, struct bot *dad, long long p, float e, signed char *g, short gen, unsigned long long seed) {
+  if (dad != NULL) {
+    b->dad = dad->self;
+  } else {
+    b->dad = NO_BOT;
+  }
+  b->mom = NO_BOT;
+  b->birth = tick;
+  // Reset or initialize all fields to ensure no data carries over from a previous usage of this bot slot
+  b->p = p;
+  b->lp = 0; // Assuming lp is meant to be reset. If it should inherit from dad or have a specific initial value, adjust this accordingly.
+  b->energy = e;
+  b->age = max_age;
+  b->generation = gen + 1;
+  b->nl = b->spilled = 0;
+  memset(b->loops, 0, sizeof(b->loops));
+  b->ptr = 0;
+  b->pos = 0;
+  b->rng = seed;
+  b->dir = rng_below(&b->rng, 4); // Random direction
+  b->last_adr = 0;
+
+  // Clear memory and new_gcode arrays
+  memset(b->memory, 0, sizeof(b->memory));
+  memset(b->new_gcode, 0, sizeof(b->new_gcode));
+
+  // Most births are unmutated clones: share the parent's genome without
+  // going through the table
+  if (dad != NULL && !memcmp(g, gcode_of(dad), MEM_SIZE)) {
+    b->genome = dad->genome;
+    __sync_fetch_and_add(&genome_at(b->genome)->refs, 1);
+  } else {
+    b->genome = intern_genome(g);
+  }
+  b->species = genome_at(b->genome)->species;
+}
+
+// Genome comparisons run 32 genes at a time in an AVX2 build (make
+// CFLAGS=-mavx2), 16 at a time with SSE2, which every x86-64 has, and one
+// at a time elsewhere.
+
+// Genes that are the same in a and b
+static inline int gene_matches(signed char *a, signed char *b)
+{
+  int i = 0, n = 0;
+
+#if defined(__AVX2__)
+  for (; i + 32 <= MEM_SIZE; i += 32)
+    n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(a + i)),
+                                                                   _mm256_loadu_si256((__m256i *)(b + i)))));
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= MEM_SIZE; i += 16)
+    n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(a + i)),
+                                                             _mm_loadu_si128((__m128i *)(b + i)))));
+#endif
+  for (; i < MEM_SIZE; i++)
+    n += a[i] == b[i];
+  return n;
+}
+
+// Which of the last 9 genes differ: bit k for gene MEM_SIZE - 9 + k
+static inline int tail_mismatches(signed char *a, signed char *b)
+{
+#if defined(__SSE2__)
+  __m128i eq = _mm_cmpeq_epi8(_mm_loadl_epi64((__m128i *)(a + MEM_SIZE - 8)),
+                              _mm_loadl_epi64((__m128i *)(b + MEM_SIZE - 8)));
+  int same = (_mm_movemask_epi8(eq) & 0xff) << 1 | (a[MEM_SIZE - 9] == b[MEM_SIZE - 9]);
+#else
+  int same = 0, i;
+  for (i = 0; i < 9; i++)
+    same |= (a[MEM_SIZE - 9 + i] == b[MEM_SIZE - 9 + i]) << i;
+#endif
+  return ~same & 0x1ff;
+}
+
+// Whether five genes drawn from the last 9 (the colour genes) match. The
+// nine are compared at once, so only genomes that differ in some but not
+// all of them need the draw, and one draw below 9^5 picks all five.
+char compatible(struct bot *b1, struct bot *b2)
+{
+  int differ, d, i;
+
+  if (b1 == NULL || b2 == NULL)
+    return 0;
+  if (b1->genome == b2->genome)
+    return 1;
+  differ = tail_mismatches(gcode_of(b1), gcode_of(b2));
+  if (differ == 0 || differ == 0x1ff)
+    return differ == 0;
+  d = rng_below(&b2->rng, 59049);
+  for (i = 0; i < 5; i++, d /= 9)
+    if (differ >> (8 - d % 9) & 1)
+      return 0;
+  return 1;
+}
+
+float compatibility(signed char *gcode, struct bot *b)
+{
+  return (float)gene_matches(gcode, gcode_of(b)) / MEM_SIZE;
+}
+
+// Scores every genome alive against "selected" for the compatibility view,
+// in one pass over the genome table rather than one per bot. Genomes
+// already scored for this selection are skipped, so between selections a
+// frame only scores the genomes that are new since the last one.
+void score_genomes(void)
+{
+  struct genome *e;
+  int id;
+
+  for (id = 1; id < genome_top; id++)
+  {
+    e = genome_at(id);
+    if (e->refs > 0 && e->comp_version != selected_version)
+    {
+      e->comp = (float)gene_matches(selected, e->gcode) / MEM_SIZE * 255;
+      e->comp_version = selected_version;
+    }
+  }
+}
+
+struct bot *spawn_bot(struct worker *w)
+{
+  struct bot *b;
+  if (w->nreserve == 0)
+    return NULL;
+  b = claim_slot(w->reserve[--w->nreserve]);
+  w->born[w->nborn++] = b->self & SLOT_MASK;
+  return b;
+}
+
+// Worlds need cells on every side of a bot, and a chunk directory that
+// fits in memory
+int world_size_ok(long w, long h)
+{
+  return w >= 3 && h >= 3 && w < 1L << 30 && h < 1L << 30 &&
+         ((w + CHUNK - 1) >> CHUNK_BITS) * ((h + CHUNK - 1) >> CHUNK_BITS) <= 1L << 26;
+}
+
+// Cells to the right of, above, left of and below p (b->dir 0 to 3), or -1
+// past an edge. Without --wrap the cells run on from the end of one row to
+// the start of the next, as they always have, so only the top and bottom
+// are edges; with it the world is a torus and there are none.
+static inline void neighbours(long long p, long long *around)
+{
+  int x = POS_X(p), y = POS_Y(p);
+
+  if (wrap)
+  {
+    around[0] = x + 1 < sx ? p + 1 : POS(0, y);
+    around[1] = y > 0 ? p - POS(0, 1) : POS(x, sy - 1);
+    around[2] = x > 0 ? p - 1 : POS(sx - 1, y);
+    around[3] = y + 1 < sy ? p + POS(0, 1) : POS(x, 0);
+  }
+  else
+  {
+    around[0] = x + 1 < sx ? p + 1 : y + 1 < sy ? POS(0, y + 1) : -1;
+    around[1] = y > 0 ? p - POS(0, 1) : -1;
+    around[2] = x > 0 ? p - 1 : y > 0 ? POS(sx - 1, y - 1) : -1;
+    around[3] = y + 1 < sy ? p + POS(0, 1) : -1;
+  }
+}
+
+// Runs the instruction at b->pos and returns its kind
+int step(struct bot *b, struct worker *w)
+{
+  struct genome *e = genome_at(b->genome);
+  struct op *op = &e->code[b->pos];
+  signed char ngcode[MEM_SIZE];
+  unsigned char *entry;
+  struct bot *nb;
+  int mean, index, i;
+  long long around[4];
+  // A fused run costs as much as the instructions it stands for
+  b->energy -= op->n;
+  b->age -= op->n;
+  b->pos = op->next;
+  VM_STAT_ADD(w, executed[op->kind], op->n);
+  switch (op->kind)
+  {
+    case 1:
+      b->ptr += op->n;
+      if (b->ptr > MEM_SIZE + 1)
+      {
+        VM_STAT(w, halted[1]);
+        b->pos = HALT_POS;
       }
       break;
-    case 13:
-      // b->energy -= 40;
-      switch (b->dir)
+    case 2:
+      b->ptr -= op->n;
+      if (b->ptr < 0)
       {
-        case 2:
-          if (b->p + 1 < SX * SY && lb[b->p + 1] == NULL)
-          {
-            lb[b->p + 1] = b;
-            b->p = b->p + 1;
-          }
-          break;
-        case 3:
-          if (b->p - SX >= 0 && lb[b->p - SX] == NULL)
-          {
-            lb[b->p - SX] = b;
-            b->p = b->p - SX;
-          }
-          break;
-        case 0:
-          if (b->p - 1 >= 0 && lb[b->p - 1] == NULL)
-          {
-            lb[b->p - 1] = b;
-            b->p = b->p - 1;
-          }
-          break;
-        case 1:
-          if (b->p + SX < SX * SY && lb[b->p + SX] == NULL)
-          {
-            lb[b->p + SX] = b;
-            b->p = b->p + SX;
-          }
-          break;
+        VM_STAT(w, halted[2]);
+        b->pos = HALT_POS;
       }
       break;
-    case 14:
-      if(b->energy / 5.0 <= 0) {
+    case 3:
+      // Memory cells are bytes that stop at 127 and -128 rather than wrap
+      b->memory[b->ptr] = b->memory[b->ptr] + op->n > 127 ? 127 : b->memory[b->ptr] + op->n;
+      break;
+    case 4:
+      b->memory[b->ptr] = b->memory[b->ptr] - op->n < -128 ? -128 : b->memory[b->ptr] - op->n;
+      break;
+    case 5:
+      if (!grow_loops(b))
+      {
+        VM_STAT(w, halted[5]);
+        b->pos = HALT_POS;
         break;
       }
-      for (i = 0; i < MEM_SIZE; i++)
+      entry = loop_at(b, b->nl++);
+      if (b->memory[b->ptr])
+        entry[0] = b->pos;
+      entry[1] = b->ptr;
+      if (b->nl == MAX_LOUPS)
       {
-        ngcode[i] = b->gcode[i];
+        VM_STAT(w, halted[5]);
+        b->pos = HALT_POS;
       }
-      for (i = 0; i < 100; i++)
+      break;
+    case 6:
+      if (b->nl && b->memory[(entry = loop_at(b, b->nl - 1))[1]] <= 0)
       {
-        if (rand() % 1000 < VAR_TAX)
-          ngcode[rand() % MEM_SIZE] = rand() % 20;
-        else
-          break;
+        VM_STAT(w, ok[6]);
+        b->pos = entry[0];
+      }
+      else if (b->nl)
+      {
+        --b->nl;
       }
+      break;
+    case 7:
+      neighbours(b->p, around);
       switch (b->dir)
       {
         case 0:
-          if (b->p + 1 < SX * SY && lb[b->p + 1] == NULL)
+          if (around[0] >= 0 && cell(around[0]) != NO_BOT)
           {
-            lb[b->p + 1] = &bots[last];
-            set_bot(&bots[last++], b, b->p + 1, b->energy / 5.0, ngcode, lb, b->generation);
-            b->energy -= b->energy / 5.0;
+            if (compatible(at(around[0]), b))
+            {
+              b->memory[b->ptr] = 2;
+            }
+            else
+            {
+              b->memory[b->ptr] = 1;
+            }
           }
-          break;
+          else
+          {
+            b->memory[b->ptr] = 0;
+          }
+          break;
+        case 1:
+          if (around[1] >= 0 && cell(around[1]) != NO_BOT)
+          {
+            if (compatible(at(around[1]), b))
+            {
+              b->memory[b->ptr] = 2;
+            }
+            else
+            {
+              b->memory[b->ptr] = 1;
+            }
+          }
+          else
+          {
+            b->memory[b->ptr] = 0;
+          }
+          break;
+        case 2:
+          if (around[2] >= 0 && cell(around[2]) != NO_BOT)
+          {
+            if (compatible(at(around[2]), b))
+            {
+              b->memory[b->ptr] = 2;
+            }
+            else
+            {
+              b->memory[b->ptr] = 1;
+            }
+          }
+          else
+          {
+            b->memory[b->ptr] = 0;
+          }
+          break;
+        case 3:
+          if (around[3] >= 0 && cell(around[3]) != NO_BOT)
+          {
+            if (compatible(at(around[3]), b))
+            {
+              b->memory[b->ptr] = 2;
+            }
+            else
+            {
+              b->memory[b->ptr] = 1;
+            }
+          }
+          else
+          {
+            b->memory[b->ptr] = 0;
+          }
+          break;
+      }
+      break;
+    case 8:
+      b->memory[b->ptr] = b->dir;
+      break;
+    case 9:
+      if (b->last_adr < MEM_SIZE)
+        b->new_gcode[b->last_adr++] = b->memory[b->ptr];
+      break;
+    case 10:
+      switch (b->dir)
+      {
+        case 0:
+          b->dir = 1;
+          break;
+        case 1:
+          b->dir = 2;
+          break;
+        case 2:
+          b->dir = 3;
+          break;
+        case 3:
+          b->dir = 0;
+          break;
+      }
+      break;
+    case 11:
+      switch (b->dir)
+      {
+        case 0:
+          b->dir = 3;
+          break;
+        case 1:
+          b->dir = 0;
+          break;
+        case 2:
+          b->dir = 1;
+          break;
+        case 3:
+          b->dir = 2;
+          break;
+      }
+      break;
+    case 12:
+      neighbours(b->p, around);
+      // b->energy -= 40;
+      switch (b->dir)
+      {
+        case 0:
+          if (around[0] >= 0 && cell(around[0]) == NO_BOT)
+          {
+            VM_STAT(w, ok[12]);
+            move_cell(b->p, around[0], b->self);
+            b->p = around[0];
+          }
+          break;
+        case 1:
+          if (around[1] >= 0 && cell(around[1]) == NO_BOT)
+          {
+            VM_STAT(w, ok[12]);
+            move_cell(b->p, around[1], b->self);
+            b->p = around[1];
+          }
+          break;
+        case 2:
+          if (around[2] >= 0 && cell(around[2]) == NO_BOT)
+          {
+            VM_STAT(w, ok[12]);
+            move_cell(b->p, around[2], b->self);
+            b->p = around[2];
+          }
+          break;
+        case 3:
+          if (around[3] >= 0 && cell(around[3]) == NO_BOT)
+          {
+            VM_STAT(w, ok[12]);
+            move_cell(b->p, around[3], b->self);
+            b->p = around[3];
+          }
+          break;
+      }
+      break;
+    case 13:
+      neighbours(b->p, around);
+      // b->energy -= 40;
+      switch (b->dir)
+      {
+        case 2:
+          if (around[0] >= 0 && cell(around[0]) == NO_BOT)
+          {
+            VM_STAT(w, ok[13]);
+            move_cell(b->p, around[0], b->self);
+            b->p = around[0];
+          }
+          break;
+        case 3:
+          if (around[1] >= 0 && cell(around[1]) == NO_BOT)
+          {
+            VM_STAT(w, ok[13]);
+            move_cell(b->p, around[1], b->self);
+            b->p = around[1];
+          }
+          break;
+        case 0:
+          if (around[2] >= 0 && cell(around[2]) == NO_BOT)
+          {
+            VM_STAT(w, ok[13]);
+            move_cell(b->p, around[2], b->self);
+            b->p = around[2];
+          }
+          break;
+        case 1:
+          if (around[3] >= 0 && cell(around[3]) == NO_BOT)
+          {
+            VM_STAT(w, ok[13]);
+            move_cell(b->p, around[3], b->self);
+            b->p = around[3];
+          }
+          break;
+      }
+      break;
+    case 14:
+      neighbours(b->p, around);
+      if(b->energy / 5.0 <= 0) {
+        break;
+      }
+      for (i = 0; i < MEM_SIZE; i++)
+      {
+        ngcode[i] = gcode_of(b)[i];
+      }
+      for (i = 0; i < 100; i++)
+      {
+        if (rng_below(&b->rng, 1000) < VAR_TAX)
+          ngcode[rng_below(&b->rng, MEM_SIZE)] = rng_below(&b->rng, 20);
+        else
+          break;
+      }
+      switch (b->dir)
+      {
+        case 0:
+          if (around[0] >= 0 && cell(around[0]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
+          {
+            VM_STAT(w, ok[14]);
+            set_cell(around[0], nb->self);
+            set_bot(nb, b, around[0], b->energy / 5.0, ngcode, b->generation, rng_split(&b->rng));
+            b->energy -= b->energy / 5.0;
+          }
+          break;
         case 1:
-          if (b->p - SX >= 0 && lb[b->p - SX] == NULL)
+          if (around[1] >= 0 && cell(around[1]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            lb[b->p - SX] = &bots[last];
-            set_bot(&bots[last++], b, b->p - SX, b->energy / 5.0, ngcode, lb, b->generation);
+            VM_STAT(w, ok[14]);
+            set_cell(around[1], nb->self);
+            set_bot(nb, b, around[1], b->energy / 5.0, ngcode, b->generation, rng_split(&b->rng));
             b->energy -= b->energy / 5.0;
           }
           break;
         case 2:
-          if (b->p - 1 >= 0 && lb[b->p - 1] == NULL)
+          if (around[2] >= 0 && cell(around[2]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            lb[b->p - 1] = &bots[last];
-            set_bot(&bots[last++], b, b->p - 1, b->energy / 5.0, ngcode, lb, b->generation);
+            VM_STAT(w, ok[14]);
+            set_cell(around[2], nb->self);
+            set_bot(nb, b, around[2], b->energy / 5.0, ngcode, b->generation, rng_split(&b->rng));
             b->energy -= b->energy / 5.0;
           }
           break;
         case 3:
-          if (b->p + SX < SX * SY && lb[b->p + SX] == NULL)
+          if (around[3] >= 0 && cell(around[3]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            lb[b->p + SX] = &bots[last];
-            set_bot(&bots[last++], b, b->p + SX, b->energy / 5.0, ngcode, lb, b->generation);
+            VM_STAT(w, ok[14]);
+            set_cell(around[3], nb->self);
+            set_bot(nb, b, around[3], b->energy / 5.0, ngcode, b->generation, rng_split(&b->rng));
             b->energy -= b->energy / 5.0;
           }
           break;
       }
       break;
     case 15:
+      neighbours(b->p, around);
+      // Crossover point: genes before it come from b, the rest from its mate
+      index = rng_below(&b->rng, MEM_SIZE);
       switch (b->dir)
       {
-        index = rand() % MEM_SIZE;
         case 0:
-          if (b->p + 1 < SX * SY && b->p + SX < SX * SY && lb[b->p + 1] != NULL && lb[b->p + SX] == NULL)
+          if (around[0] >= 0 && around[3] >= 0 && cell(around[0]) != NO_BOT && cell(around[3]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            //&& compatible(lb[b->p + 1], b)) {
+            VM_STAT(w, ok[15]);
+            //&& compatible(at(around[0]), b)) {
             for (i = 0; i < index; i++)
             {
-              ngcode[i] = b->gcode[i];
+              ngcode[i] = gcode_of(b)[i];
             }
             for (i = index; i < MEM_SIZE; i++)
             {
-              ngcode[i] = lb[b->p + 1]->gcode[i];
+              ngcode[i] = gcode_of(at(around[0]))[i];
             }
             for (i = 0; i < 100; i++)
             {
-              if (rand() % 1000 < VAR_TAX)
-                ngcode[rand() % MEM_SIZE] = rand() % 20;
+              if (rng_below(&b->rng, 1000) < VAR_TAX)
+                ngcode[rng_below(&b->rng, MEM_SIZE)] = rng_below(&b->rng, 20);
                 else
               break;
             }
-            // set_bot(&bots[last++], b, b->p + SX, b->energy / 5.0 + lb[b->p + 1]->energy / 5.0, ngcode, lb, b->generation > lb[b->p + 1]->generation ? b->generation : lb[b->p + 1]->generation);
-            set_bot(&bots[last++], b, b->p + SX, b->energy / 5.0, ngcode, lb, b->generation > lb[b->p + 1]->generation ? b->generation : lb[b->p + 1]->generation);
+            // set_bot(&bots[last++], b, around[3], b->energy / 5.0 + at(around[0])->energy / 5.0, ngcode, b->generation > at(around[0])->generation ? b->generation : at(around[0])->generation);
+            set_cell(around[3], nb->self);
+            set_bot(nb, b, around[3], b->energy / 5.0, ngcode, b->generation > at(around[0])->generation ? b->generation : at(around[0])->generation, rng_split(&b->rng));
+            nb->mom = cell(around[0]);
             b->energy -= b->energy / 5.0;
-            // lb[b->p + 1]->energy -= lb[b->p + 1]->energy / 5.0;
+            // at(around[0])->energy -= at(around[0])->energy / 5.0;
           }
           break;
         case 1:
-          if (b->p - SX >= 0 && b->p + 1 < SX * SY && lb[b->p - SX] != NULL && lb[b->p + 1] == NULL)
+          if (around[1] >= 0 && around[0] >= 0 && cell(around[1]) != NO_BOT && cell(around[0]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            //&& compatible(lb[b->p - SX], b)) {
+            VM_STAT(w, ok[15]);
+            //&& compatible(at(around[1]), b)) {
             for (i = 0; i < index; i++)
             {
-              ngcode[i] = b->gcode[i];
+              ngcode[i] = gcode_of(b)[i];
             }
             for (i = index; i < MEM_SIZE; i++)
             {
-              ngcode[i] = lb[b->p - SX]->gcode[i];
+              ngcode[i] = gcode_of(at(around[1]))[i];
             }
             for (i = 0; i < 100; i++)
             {
-              if (rand() % 1000 < VAR_TAX)
-                ngcode[rand() % MEM_SIZE] = rand() % 20;
+              if (rng_below(&b->rng, 1000) < VAR_TAX)
+                ngcode[rng_below(&b->rng, MEM_SIZE)] = rng_below(&b->rng, 20);
                 else
               break;
             }
-            // set_bot(&bots[last++], b, b->p + 1, b->energy / 5.0 + lb[b->p - SX]->energy / 5.0, ngcode, lb, b->generation > lb[b->p - SX]->generation ? b->generation : lb[b->p - SX]->generation);
-            set_bot(&bots[last++], b, b->p + 1, b->energy / 5.0, ngcode, lb, b->generation > lb[b->p - SX]->generation ? b->generation : lb[b->p - SX]->generation);
+            // set_bot(&bots[last++], b, around[0], b->energy / 5.0 + at(around[1])->energy / 5.0, ngcode, b->generation > at(around[1])->generation ? b->generation : at(around[1])->generation);
+            set_cell(around[0], nb->self);
+            set_bot(nb, b, around[0], b->energy / 5.0, ngcode, b->generation > at(around[1])->generation ? b->generation : at(around[1])->generation, rng_split(&b->rng));
+            nb->mom = cell(around[1]);
             b->energy -= b->energy / 5.0;
-            // lb[b->p - SX]->energy -= lb[b->p - SX]->energy / 5.0;
+            // at(around[1])->energy -= at(around[1])->energy / 5.0;
           }
           break;
         case 2:
-          if (b->p - 1 >= 0 && b->p - SX >= 0 && lb[b->p - 1] != NULL && lb[b->p - SX] == NULL)
+          if (around[2] >= 0 && around[1] >= 0 && cell(around[2]) != NO_BOT && cell(around[1]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            //&& compatible(lb[b->p - 1], b)) {
+            VM_STAT(w, ok[15]);
+            //&& compatible(at(around[2]), b)) {
             for (i = 0; i < index; i++)
             {
-              ngcode[i] = b->gcode[i];
+              ngcode[i] = gcode_of(b)[i];
             }
             for (i = index; i < MEM_SIZE; i++)
             {
-              ngcode[i] = lb[b->p - 1]->gcode[i];
+              ngcode[i] = gcode_of(at(around[2]))[i];
             }
             for (i = 0; i < 100; i++)
             {
-              if (rand() % 1000 < VAR_TAX)
-                ngcode[rand() % MEM_SIZE] = rand() % 20;
+              if (rng_below(&b->rng, 1000) < VAR_TAX)
+                ngcode[rng_below(&b->rng, MEM_SIZE)] = rng_below(&b->rng, 20);
                 else
               break;
             }
-            // set_bot(&bots[last++], b, b->p - SX, b->energy / 5.0 + lb[b->p - 1]->energy / 5.0, ngcode, lb, b->generation > lb[b->p - 1]->generation ? b->generation : lb[b->p - 1]->generation);
-            set_bot(&bots[last++], b, b->p - SX, b->energy / 5.0, ngcode, lb, b->generation > lb[b->p - 1]->generation ? b->generation : lb[b->p - 1]->generation);
+            // set_bot(&bots[last++], b, around[1], b->energy / 5.0 + at(around[2])->energy / 5.0, ngcode, b->generation > at(around[2])->generation ? b->generation : at(around[2])->generation);
+            set_cell(around[1], nb->self);
+            set_bot(nb, b, around[1], b->energy / 5.0, ngcode, b->generation > at(around[2])->generation ? b->generation : at(around[2])->generation, rng_split(&b->rng));
+            nb->mom = cell(around[2]);
             b->energy -= b->energy / 5.0;
-            // lb[b->p - 1]->energy -= lb[b->p - 1]->energy / 5.0;
+            // at(around[2])->energy -= at(around[2])->energy / 5.0;
           }
           break;
         case 3:
-          if (b->p + SX < SX * SY && b->p - 1 >= 0 && lb[b->p + SX] != NULL && lb[b->p - 1] == NULL)
+          if (around[3] >= 0 && around[2] >= 0 && cell(around[3]) != NO_BOT && cell(around[2]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            //&& compatible(lb[b->p + SX], b)) {
+            VM_STAT(w, ok[15]);
+            //&& compatible(at(around[3]), b)) {
             for (i = 0; i < index; i++)
             {
-              ngcode[i] = b->gcode[i];
+              ngcode[i] = gcode_of(b)[i];
             }
             for (i = index; i < MEM_SIZE; i++)
             {
-              ngcode[i] = lb[b->p + SX]->gcode[i];
+              ngcode[i] = gcode_of(at(around[3]))[i];
             }
             for (i = 0; i < 100; i++)
             {
-              if (rand() % 1000 < VAR_TAX)
-                ngcode[rand() % MEM_SIZE] = rand() % 20;
+              if (rng_below(&b->rng, 1000) < VAR_TAX)
+                ngcode[rng_below(&b->rng, MEM_SIZE)] = rng_below(&b->rng, 20);
                 else
               break;
             }
-            // set_bot(&bots[last++], b, b->p - 1, b->energy / 5.0 + lb[b->p + SX]->energy / 5.0, ngcode, lb, b->generation > lb[b->p + SX]->generation ? b->generation : lb[b->p + SX]->generation);
-            set_bot(&bots[last++], b, b->p - 1, b->energy / 5.0, ngcode, lb, b->generation > lb[b->p + SX]->generation ? b->generation : lb[b->p + SX]->generation);
+            // set_bot(&bots[last++], b, around[2], b->energy / 5.0 + at(around[3])->energy / 5.0, ngcode, b->generation > at(around[3])->generation ? b->generation : at(around[3])->generation);
+            set_cell(around[2], nb->self);
+            set_bot(nb, b, around[2], b->energy / 5.0, ngcode, b->generation > at(around[3])->generation ? b->generation : at(around[3])->generation, rng_split(&b->rng));
+            nb->mom = cell(around[3]);
             b->energy -= b->energy / 5.0;
-            // lb[b->p + SX]->energy -= lb[b->p + SX]->energy / 5.0;
+            // at(around[3])->energy -= at(around[3])->energy / 5.0;
           }
           break;
       }
       break;
 
     case 16:
+      neighbours(b->p, around);
       switch (b->dir)
       {
         case 0:
-          if (b->p + 1 < SX * SY && lb[b->p + 1] != NULL)
+          if (around[0] >= 0 && cell(around[0]) != NO_BOT)
           {
-            b->energy += lb[b->p + 1]->energy / 10.0;
-            lb[b->p + 1]->energy = lb[b->p + 1]->energy / 10.0 * 9;
+            VM_STAT(w, ok[16]);
+            b->energy += at(around[0])->energy / 10.0;
+            at(around[0])->energy = at(around[0])->energy / 10.0 * 9;
           }
           break;
         case 1:
-          if (b->p - SX >= 0 && lb[b->p - SX] != NULL)
+          if (around[1] >= 0 && cell(around[1]) != NO_BOT)
           {
-            b->energy += lb[b->p - SX]->energy / 10.0;
-            lb[b->p - SX]->energy = lb[b->p - SX]->energy / 10.0 * 9;
+            VM_STAT(w, ok[16]);
+            b->energy += at(around[1])->energy / 10.0;
+            at(around[1])->energy = at(around[1])->energy / 10.0 * 9;
           }
           break;
         case 2:
-          if (b->p - 1 >= 0 && lb[b->p - 1] != NULL)
+          if (around[2] >= 0 && cell(around[2]) != NO_BOT)
           {
-            b->energy += lb[b->p - 1]->energy / 10.0;
-            lb[b->p - 1]->energy = lb[b->p - 1]->energy / 10.0 * 9;
+            VM_STAT(w, ok[16]);
+            b->energy += at(around[2])->energy / 10.0;
+            at(around[2])->energy = at(around[2])->energy / 10.0 * 9;
           }
           break;
         case 3:
-          if (b->p + SX < SX * SY && lb[b->p + SX] != NULL)
+          if (around[3] >= 0 && cell(around[3]) != NO_BOT)
           {
-            b->energy += lb[b->p + SX]->energy / 10.0;
-            lb[b->p + SX]->energy = lb[b->p + SX]->energy / 10.0 * 9;
+            VM_STAT(w, ok[16]);
+            b->energy += at(around[3])->energy / 10.0;
+            at(around[3])->energy = at(around[3])->energy / 10.0 * 9;
           }
           break;
       }
       break;
     case 17:
+      neighbours(b->p, around);
       switch (b->dir)
       {
         case 0:
-          if (b->p + 1 < SX * SY && lb[b->p + 1] != NULL && compatible(lb[b->p + 1], b))
+          if (around[0] >= 0 && cell(around[0]) != NO_BOT && compatible(at(around[0]), b))
           {
-            mean = (b->energy + lb[b->p + 1]->energy) / 2.0;
+            VM_STAT(w, ok[17]);
+            mean = (b->energy + at(around[0])->energy) / 2.0;
             b->energy = mean;
-            lb[b->p + 1]->energy = mean;
+            at(around[0])->energy = mean;
           }
           break;
         case 1:
-          if (b->p - SX >= 0 && lb[b->p - SX] != NULL && compatible(lb[b->p - SX], b))
+          if (around[1] >= 0 && cell(around[1]) != NO_BOT && compatible(at(around[1]), b))
           {
-            mean = (b->energy + lb[b->p - SX]->energy) / 2.0;
+            VM_STAT(w, ok[17]);
+            mean = (b->energy + at(around[1])->energy) / 2.0;
             b->energy = mean;
-            lb[b->p - SX]->energy = mean;
+            at(around[1])->energy = mean;
           }
           break;
         case 2:
-          if (b->p - 1 >= 0 && lb[b->p - 1] != NULL && compatible(lb[b->p - 1], b))
+          if (around[2] >= 0 && cell(around[2]) != NO_BOT && compatible(at(around[2]), b))
           {
-            mean = (b->energy + lb[b->p - 1]->energy) / 2.0;
+            VM_STAT(w, ok[17]);
+            mean = (b->energy + at(around[2])->energy) / 2.0;
             b->energy = mean;
-            lb[b->p - 1]->energy = mean;
+            at(around[2])->energy = mean;
           }
           break;
         case 3:
-          if (b->p + SX < SX * SY && lb[b->p + SX] != NULL && compatible(lb[b->p + SX], b))
+          if (around[3] >= 0 && cell(around[3]) != NO_BOT && compatible(at(around[3]), b))
           {
-            mean = (b->energy + lb[b->p + SX]->energy) / 2.0;
+            VM_STAT(w, ok[17]);
+            mean = (b->energy + at(around[3])->energy) / 2.0;
             b->energy = mean;
-            lb[b->p + SX]->energy = mean;
+            at(around[3])->energy = mean;
           }
           break;
       }
       break;
     case 18:
+      neighbours(b->p, around);
       switch (b->dir)
       {
         case 0:
-          if (b->p + 1 < SX * SY && lb[b->p + 1] == NULL)
+          if (around[0] >= 0 && cell(around[0]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            lb[b->p + 1] = &bots[last];
-            set_bot(&bots[last++], b, b->p + 1, b->energy / 5.0, b->new_gcode, lb, b->generation);
+            VM_STAT(w, ok[18]);
+            set_cell(around[0], nb->self);
+            set_bot(nb, b, around[0], b->energy / 5.0, b->new_gcode, b->generation, rng_split(&b->rng));
             b->energy -= b->energy / 5.0;
           }
           break;
         case 1:
-          if (b->p - SX >= 0 && lb[b->p - SX] == NULL)
+          if (around[1] >= 0 && cell(around[1]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
           {
-            lb[b->p - SX] = &bots[last];
-            set_bot(&bots[last++], b, b->p - SX, b->energy / 5.0, b->new_gcode, lb, b->generation);
+            VM_STAT(w, ok[18]);
+            set_cell(around[1], nb->self);
+            set_bot(nb, b, around[1], b->energy / 5.0, b->new_gcode, b->generation, rng_split(&b->rng));
             b->energy -= b->energy / 5.0;
           }
           break;
         case 2:
-          if (b->p - 1 >= 0 && lb[b->p - 1] == NULL)
+          if (around[2] >= 0 && cell(around[2]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
+          {
+            VM_STAT(w, ok[18]);
+            set_cell(around[2], nb->self);
+            set_bot(nb, b, around[2], b->energy / 5.0, b->new_gcode, b->generation, rng_split(&b->rng));
+            b->energy -= b->energy / 5.0;
+          }
+          break;
+        case 3:
+          if (around[3] >= 0 && cell(around[3]) == NO_BOT && (nb = spawn_bot(w)) != NULL)
+          {
+            VM_STAT(w, ok[18]);
+            set_cell(around[3], nb->self);
+            set_bot(nb, b, around[3], b->energy / 5.0, b->new_gcode, b->generation, rng_split(&b->rng));
+            b->energy -= b->energy / 5.0;
+          }
+          break;
+      }
+      break;
+    case 19:
+      if (b->last_adr < MEM_SIZE)
+        b->new_gcode[b->last_adr++] = e->gcode[b->pos++];
+      break;
+  }
+  // b->memory[b->ptr] = b->memory[b->ptr] % 9;
+#ifdef VM_STATS
+  if (op->kind == 7)
+    w->stats.sensed[b->memory[b->ptr]]++;
+#endif
+  return op->kind;
+}
+
+// One tick of bot b: instructions that only touch the bot itself run
+// back-to-back until "slice" of them have been paid for, the bot runs out of
+// energy or age, or it runs an instruction that reads or changes the world
+// (7, 12 - 18). So each bot still acts on the world at most once per tick,
+// in tile order, and every instruction costs what it did at --slice 1.
+void compute(struct bot *b, struct worker *w)
+{
+  int kind, done = 0;
+  do
+  {
+    done += genome_at(b->genome)->code[b->pos].n;
+    kind = step(b, w);
+    if (kind == OP_HALT && done < slice)
+    {
+      // Halted for good, so the rest of the slice only costs
+      b->energy -= slice - done;
+      b->age -= slice - done;
+      break;
+    }
+  } while (done < slice && b->energy > 0 && b->age > 0 && kind != 7 && (kind < 12 || kind > 18));
+  w->instructions += done;
+}
+
+void init_workers(void)
+{
+  workers = (struct worker *)calloc(threads, sizeof(struct worker));
+}
+
+int compare_chunks(const void *a, const void *b)
+{
+  unsigned long long ka = (*(struct chunk **)a)->key, kb = (*(struct chunk **)b)->key;
+  return ka < kb ? -1 : ka > kb;
+}
+
+// Puts the chunks in scheduling order and counting-sorts the bots into them,
+// so a tick only looks at chunks that have bots
+void bucket_bots(void)
+{
+  int i, c;
+
+  if (tile_bots_cap < last)
+  {
+    tile_bots_cap = last * 2;
+    tile_bots = (int *)realloc(tile_bots, sizeof(int) * tile_bots_cap);
+  }
+  if (chunk_start_cap <= nactive)
+  {
+    chunk_start_cap = nactive * 2 + 1;
+    chunk_start = (int *)realloc(chunk_start, sizeof(int) * chunk_start_cap);
+  }
+  if (nactive > 1) // active is still NULL before the first chunk
+    qsort(active, nactive, sizeof(struct chunk *), compare_chunks);
+  for (i = 0; i < nactive; i++)
+    active[i]->n = 0;
+  for (i = 0; i < last; i++)
+    chunk_of(bots[live[i]].p)->n++;
+  chunk_start[0] = 0;
+  for (i = 0, c = 0; i < nactive; i++)
+  {
+    while (c <= (int)(active[i]->key >> 60))
+      color_start[c++] = i;
+    chunk_start[i + 1] = chunk_start[i] + active[i]->n;
+    active[i]->n = chunk_start[i];
+  }
+  while (c <= colors)
+    color_start[c++] = nactive;
+  chunk_start[nactive] = last;
+  for (i = 0; i < last; i++)
+    tile_bots[chunk_of(bots[live[i]].p)->n++] = live[i];
+}
+
+void run_tiles(struct worker *w)
+{
+  int i;
+  for (i = w->from; i < w->to; i++)
+    compute(&bots[tile_bots[i]], w);
+}
+
+void *worker_main(void *arg)
+{
+  struct worker *w = (struct worker *)arg;
+  for (;;)
+  {
+    pthread_barrier_wait(&phase_start);
+    if (quit_workers)
+      break;
+    run_tiles(w);
+    pthread_barrier_wait(&phase_done);
+  }
+  return NULL;
+}
+
+void start_workers(void)
+{
+  int i;
+  if (threads < 2)
+    return;
+  pthread_barrier_init(&phase_start, NULL, threads);
+  pthread_barrier_init(&phase_done, NULL, threads);
+  for (i = 1; i < threads; i++)
+    pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+}
+
+void stop_workers(void)
+{
+  int i;
+  if (threads < 2)
+    return;
+  quit_workers = 1;
+  pthread_barrier_wait(&phase_start);
+  for (i = 1; i < threads; i++)
+    pthread_join(workers[i].thread, NULL);
+}
+
+// Give a newborn its lineage id and append it to the lineage file. Only
+// called outside of phases, in birth order, so ids do not depend on the
+// thread count. Parents are alive: nothing dies before the death sweep.
+void record_birth(struct bot *b)
+{
+  struct lineage_record r;
+  struct bot *parent;
+
+  b->id = next_id++;
+  if (lineage == NULL)
+    return;
+  memset(&r, 0, sizeof(r));
+  r.id = b->id;
+  r.dad = (parent = resolve(b->dad)) != NULL ? parent->id : 0;
+  r.mom = (parent = resolve(b->mom)) != NULL ? parent->id : 0;
+  r.tick = b->birth;
+  memcpy(r.gcode, gcode_of(b), sizeof(r.gcode));
+  fwrite(&r, sizeof(r), 1, lineage);
+}
+
+// Starts a new lineage file, or after --restore carries on with the one the
+// checkpointed run was writing: the records of bots born after the
+// checkpoint are cut off, so a copy of the file can follow each branch.
+FILE *open_lineage(char *name)
+{
+  struct lineage_header h = {{'N', 'L', 'L', 'G'}, LINEAGE_VERSION, MEM_SIZE, sizeof(struct lineage_record)};
+  struct lineage_header old;
+  long size = sizeof(h) + (long)(next_id - 1) * sizeof(struct lineage_record);
+  FILE *f;
+
+  if ((f = fopen(name, next_id == 1 ? "wb" : "r+b")) == NULL)
+  {
+    perror(name);
+    return NULL;
+  }
+  if (next_id == 1)
+    fwrite(&h, sizeof(h), 1, f);
+  else
+  {
+    if (fread(&old, sizeof(old), 1, f) != 1 || memcmp(&old, &h, sizeof(h)) ||
+        fseek(f, 0, SEEK_END) || ftell(f) < size || ftruncate(fileno(f), size))
+    {
+      fprintf(stderr, "%s: does not hold the %llu births before the checkpoint\n", name, next_id - 1);
+      fclose(f);
+      return NULL;
+    }
+    fseek(f, size, SEEK_SET);
+  }
+  setvbuf(f, NULL, _IOFBF, 1 << 20);
+  return f;
+}
+
+// Checkpoint file: the header, then the whole slot pool, the live list, the
+// free slot stack and every genome table entry, each as it is in memory, so
+// restoring is a few copies out of a mapping of the file. The occupancy grid
+// is not stored since every bot knows its cell.
+#define CHECKPOINT_VERSION 6
+
+struct checkpoint_header
+{
+  char magic[4]; // "NLCP"
+  unsigned int version;
+  unsigned int mem_size, bot_size; // must match this build
+  int tick, last, food, var_tax;
+  int sx, sy, wrap;
+  float max_age;
+  int pool_cap, nfree, genome_top;
+  unsigned int best;
+  int species_top;
+  unsigned int species_labels;
+  int spilled; // loop entries past LOOP_INLINE, after the species
+  long long births, deaths, best_energy;
+  unsigned long long next_id, world_rng;
+};
+
+struct checkpoint_genome
+{
+  signed char gcode[MEM_SIZE];
+  int refs;
+  int species;
+};
+
+// Only called between ticks, or in a child forked between ticks
+int save_checkpoint(char *name)
+{
+  struct checkpoint_header h = {{'N', 'L', 'C', 'P'}, CHECKPOINT_VERSION, MEM_SIZE, sizeof(struct bot)};
+  struct checkpoint_genome g;
+  char tmp[4096];
+  FILE *f;
+  int id, i;
+
+  h.tick = tick;
+  h.last = last;
+  h.food = food;
+  h.var_tax = VAR_TAX;
+  h.sx = sx;
+  h.sy = sy;
+  h.wrap = wrap;
+  h.max_age = max_age;
+  h.pool_cap = pool_cap;
+  h.nfree = nfree;
+  h.genome_top = genome_top;
+  h.best = best;
+  h.species_top = species_top;
+  h.species_labels = species_labels;
+  for (i = 0; i < last; i++)
+    h.spilled += bots[live[i]].spilled;
+  h.births = births;
+  h.deaths = deaths;
+  h.best_energy = best_energy;
+  h.next_id = next_id;
+  h.world_rng = world_rng;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+  if ((f = fopen(tmp, "wb")) == NULL)
+    return 0;
+  fwrite(&h, sizeof(h), 1, f);
+  fwrite(bots, sizeof(struct bot), pool_cap, f);
+  fwrite(live, sizeof(int), last, f);
+  fwrite(free_slots, sizeof(int), nfree, f);
+  for (id = 1; id < genome_top; id++)
+  {
+    memcpy(g.gcode, genome_at(id)->gcode, sizeof(g.gcode));
+    g.refs = genome_at(id)->refs;
+    g.species = genome_at(id)->species;
+    fwrite(&g, sizeof(g), 1, f);
+  }
+  fwrite(species, sizeof(struct species), species_top, f);
+  for (i = 0; i < last; i++)
+    if (bots[live[i]].spilled)
+      fwrite(loop_spills[live[i]].loops, 2, bots[live[i]].spilled, f);
+  if (ferror(f) | fclose(f) || rename(tmp, name))
+  {
+    unlink(tmp);
+    return 0;
+  }
+  return 1;
+}
+
+// Snapshot in a forked child. The child sees the world as it was at fork()
+// time while the parent goes on with the next tick, and the kernel only
+// copies the pages the parent writes to meanwhile. If the last snapshot is
+// still being written this one is skipped.
+pid_t snapshot_pid = 0;
+
+void reap_snapshot(int options)
+{
+  int status;
+
+  if (snapshot_pid <= 0 || waitpid(snapshot_pid, &status, options) == 0)
+    return;
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    fprintf(stderr, "checkpoint failed\n");
+  snapshot_pid = 0;
+}
+
+void background_checkpoint(char *name)
+{
+  reap_snapshot(WNOHANG);
+  if (snapshot_pid > 0)
+    return;
+  if (lineage != NULL)
+    fflush(lineage); // so the file covers every birth in the snapshot
+  snapshot_pid = fork();
+  if (snapshot_pid == 0)
+    _exit(save_checkpoint(name) ? 0 : 1);
+  if (snapshot_pid < 0)
+  {
+    perror("fork");
+    snapshot_pid = 0;
+  }
+}
+
+// Replaces the empty world with the one in checkpoint "name", including its
+// size and rules. Without a new seed the run goes on exactly as it would
+// have; with one, the food spawner and every bot get fresh streams so each
+// branch takes its own course.
+int restore_checkpoint(char *name, int reseed, unsigned int seed)
+{
+  struct checkpoint_header *h;
+  struct checkpoint_genome *g;
+  struct genome *e;
+  struct bot *b;
+  struct stat st;
+  unsigned char *loops;
+  char *map;
+  int fd, i, id;
+
+  if ((fd = open(name, O_RDONLY)) < 0 || fstat(fd, &st) ||
+      (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+  {
+    perror(name);
+    if (fd >= 0)
+      close(fd);
+    return 0;
+  }
+  close(fd);
+  h = (struct checkpoint_header *)map;
+  if (st.st_size < (off_t)sizeof(*h) || memcmp(h->magic, "NLCP", 4) || h->version != CHECKPOINT_VERSION ||
+      h->mem_size != MEM_SIZE || h->bot_size != sizeof(struct bot) || !world_size_ok(h->sx, h->sy) ||
+      st.st_size != (off_t)(sizeof(*h) + sizeof(struct bot) * (off_t)h->pool_cap + sizeof(int) * (off_t)(h->last + h->nfree) +
+                            sizeof(struct checkpoint_genome) * (off_t)(h->genome_top - 1) +
+                            sizeof(struct species) * (off_t)h->species_top + 2 * (off_t)h->spilled) ||
+      !reserve_slots(h->pool_cap) || pool_cap != h->pool_cap)
+  {
+    fprintf(stderr, "%s: not a version %i checkpoint of this build\n", name, CHECKPOINT_VERSION);
+    munmap(map, st.st_size);
+    return 0;
+  }
+
+  memcpy(bots, map + sizeof(*h), sizeof(struct bot) * pool_cap);
+  last = h->last;
+  nfree = h->nfree;
+  memcpy(live, map + sizeof(*h) + sizeof(struct bot) * pool_cap, sizeof(int) * last);
+  memcpy(free_slots, map + sizeof(*h) + sizeof(struct bot) * pool_cap + sizeof(int) * last, sizeof(int) * nfree);
+  g = (struct checkpoint_genome *)(map + sizeof(*h) + sizeof(struct bot) * pool_cap + sizeof(int) * (last + nfree));
+  for (id = 1; id < h->genome_top; id++, g++)
+  {
+    if (genome_pages[id >> GENOME_PAGE_BITS] == NULL)
+      genome_pages[id >> GENOME_PAGE_BITS] = (struct genome *)calloc(GENOME_PAGE, sizeof(struct genome));
+    e = genome_at(id);
+    memcpy(e->gcode, g->gcode, sizeof(g->gcode));
+    e->refs = g->refs;
+    e->species = g->species;
+    e->hash = hash_genome(e->gcode);
+    decode_genome(e);
+    if (e->refs > 0)
+      ++genome_count;
+    else
+    {
+      e->next = genome_free;
+      genome_free = id;
+    }
+  }
+  genome_top = h->genome_top;
+  while (genome_nbuckets <= genome_count)
+    grow_genome_buckets();
+  species_top = species_cap = h->species_top;
+  species_labels = h->species_labels;
+  species = (struct species *)malloc(sizeof(struct species) * (species_cap + 1));
+  memcpy(species, g, sizeof(struct species) * species_top);
+  for (i = species_top - 1; i >= 0; i--)
+    if (species[i].label)
+      ++species_count;
+    else
+    {
+      species[i].next[0] = species_free;
+      species_free = i;
+    }
+  while (species_nbuckets <= species_count * 2 * SPECIES_BANDS)
+    grow_species_buckets();
+  loops = (unsigned char *)g + sizeof(struct species) * species_top;
+  for (i = 0; i < last; i++)
+  {
+    if ((b = &bots[live[i]])->spilled == 0)
+      continue;
+    if (!reserve_loops(live[i], b->spilled))
+    {
+      fprintf(stderr, "%s: out of memory\n", name);
+      munmap(map, st.st_size);
+      return 0;
+    }
+    memcpy(loop_spills[live[i]].loops, loops, 2 * b->spilled);
+    loops += 2 * b->spilled;
+  }
+
+  sx = h->sx;
+  sy = h->sy;
+  wrap = h->wrap;
+  init_world();
+  max_age = h->max_age;
+  for (i = 0; i < last; i++)
+    set_cell(bots[live[i]].p, bots[live[i]].self);
+  tick = h->tick;
+  food = h->food;
+  VAR_TAX = h->var_tax;
+  best = h->best;
+  best_energy = h->best_energy;
+  births = h->births;
+  deaths = h->deaths;
+  next_id = h->next_id;
+  world_rng = h->world_rng;
+  if (reseed)
+  {
+    world_rng = seed;
+    for (i = 0; i < last; i++)
+      bots[live[i]].rng = rng_split(&world_rng);
+  }
+  munmap(map, st.st_size);
+  return 1;
+}
+
+// Telemetry: every 10 ticks the main loop puts a record in a ring buffer and
+// a writer thread moves it to the file, so the tick loop never waits on the
+// disk. The file is a header and then fixed-size records; it is appended to,
+// so a run that is restarted adds a new header and carries on. Convert it
+// back to the old data.txt lines with telemetry_reader.py.
+#define TELEMETRY_VERSION 3
+#define RING_SIZE 4096 // records, a power of two
+
+struct telemetry_header
+{
+  char magic[4]; // "NLTM"
+  unsigned int version;
+  unsigned int mem_size;
+  unsigned int record_size;
+};
+
+struct telemetry_record
+{
+  unsigned int tick;
+  int population;
+  float energy;
+  int genomes; // distinct genomes alive
+  signed char gcode[MEM_SIZE]; // of the best bot
+  int species; // species alive
+  struct telemetry_species
+  {
+    unsigned int label;
+    int population, genomes;
+    float energy;
+    int births, deaths; // since the last record
+  } top[TOP_SPECIES]; // the biggest species, biggest first; label 0 past the last
+};
+
+// Single producer (the main loop), single consumer (the writer thread):
+// each index is only written by its owner and read by the other side.
+struct telemetry_record ring[RING_SIZE];
+unsigned int ring_head = 0, ring_tail = 0;
+long telemetry_dropped = 0;
+
+char *telemetry_name = "data.bin";
+int telemetry_gzip = 0; // --telemetry-gzip, pipe the stream through gzip
+long telemetry_rotate = 0; // --telemetry-rotate, bytes per file, 0 = never
+int telemetry_quit = 0;
+pthread_t telemetry_thread;
+FILE *telemetry;
+pid_t telemetry_gzip_pid;
+long telemetry_bytes;
+
+int open_telemetry(void)
+{
+  struct telemetry_header h = {{'N', 'L', 'T', 'M'}, TELEMETRY_VERSION, MEM_SIZE, sizeof(struct telemetry_record)};
+  int fd, p[2];
+
+  if ((fd = open(telemetry_name, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)
+  {
+    perror(telemetry_name);
+    return 0;
+  }
+  if (telemetry_gzip)
+  {
+    // Appended gzip members read back as one stream
+    if (pipe(p))
+    {
+      perror("pipe");
+      close(fd);
+      return 0;
+    }
+    fcntl(p[1], F_SETFD, FD_CLOEXEC);
+    if ((telemetry_gzip_pid = fork()) == 0)
+    {
+      dup2(p[0], 0);
+      dup2(fd, 1);
+      execlp("gzip", "gzip", "-c", (char *)NULL);
+      _exit(127);
+    }
+    close(p[0]);
+    close(fd);
+    fd = p[1];
+  }
+  telemetry = fdopen(fd, "wb");
+  setvbuf(telemetry, NULL, _IOFBF, 1 << 16);
+  fwrite(&h, sizeof(h), 1, telemetry);
+  telemetry_bytes = sizeof(h);
+  return 1;
+}
+
+void close_telemetry(void)
+{
+  fclose(telemetry);
+  telemetry = NULL;
+  if (telemetry_gzip)
+    waitpid(telemetry_gzip_pid, NULL, 0);
+}
+
+// The full file becomes FILE.1, FILE.2, ... and a new FILE is started, so
+// the oldest records are in the lowest numbered file
+void rotate_telemetry(void)
+{
+  char name[4096];
+  struct stat st;
+  int n = 1;
+
+  close_telemetry();
+  do
+    snprintf(name, sizeof(name), "%s.%i", telemetry_name, n++);
+  while (stat(name, &st) == 0);
+  if (rename(telemetry_name, name) || !open_telemetry())
+    fprintf(stderr, "%s: rotation failed, telemetry stopped\n", telemetry_name);
+}
+
+void *telemetry_main(void *arg)
+{
+  unsigned int head;
+  struct timespec idle = {0, 1000000};
+
+  for (;;)
+  {
+    head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    if (ring_tail == head)
+    {
+      if (__atomic_load_n(&telemetry_quit, __ATOMIC_ACQUIRE))
+        break;
+      if (telemetry != NULL)
+        fflush(telemetry);
+      nanosleep(&idle, NULL);
+      continue;
+    }
+    while (ring_tail != head)
+    {
+      if (telemetry != NULL)
+      {
+        fwrite(&ring[ring_tail & (RING_SIZE - 1)], sizeof(struct telemetry_record), 1, telemetry);
+        telemetry_bytes += sizeof(struct telemetry_record);
+      }
+      __atomic_store_n(&ring_tail, ring_tail + 1, __ATOMIC_RELEASE);
+      if (telemetry != NULL && telemetry_rotate && telemetry_bytes >= telemetry_rotate)
+        rotate_telemetry();
+    }
+  }
+  if (telemetry != NULL)
+    close_telemetry();
+  return NULL;
+}
+
+// Called from the main loop only. Never waits: if the writer has fallen a
+// whole ring behind, the record is counted and dropped.
+void push_telemetry(int population, float energy, int genomes, signed char *best_gcode)
+{
+  struct telemetry_record *r;
+  struct species *c;
+  int top[TOP_SPECIES], i, n;
+
+  if (ring_head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+    ++telemetry_dropped;
+  else
+  {
+    r = &ring[ring_head & (RING_SIZE - 1)];
+    r->tick = tick;
+    r->population = population;
+    r->energy = energy;
+    r->genomes = genomes;
+    // No best bot when the world has died out
+    if (best_gcode != NULL)
+      memcpy(r->gcode, best_gcode, sizeof(r->gcode));
+    else
+      memset(r->gcode, 0, sizeof(r->gcode));
+    r->species = species_count;
+    memset(r->top, 0, sizeof(r->top));
+    n = top_species(top, TOP_SPECIES);
+    for (i = 0; i < n; i++)
+    {
+      c = &species[top[i]];
+      r->top[i].label = c->label;
+      r->top[i].population = c->population;
+      r->top[i].genomes = c->genomes;
+      r->top[i].energy = c->energy;
+      r->top[i].births = c->births;
+      r->top[i].deaths = c->deaths;
+    }
+    __atomic_store_n(&ring_head, ring_head + 1, __ATOMIC_RELEASE);
+  }
+  // Species births and deaths are counted per record
+  for (i = 0; i < species_top; i++)
+    species[i].births = species[i].deaths = 0;
+}
+
+int start_telemetry(void)
+{
+  if (!open_telemetry())
+    return 0;
+  pthread_create(&telemetry_thread, NULL, telemetry_main, NULL);
+  return 1;
+}
+
+void stop_telemetry(void)
+{
+  __atomic_store_n(&telemetry_quit, 1, __ATOMIC_RELEASE);
+  pthread_join(telemetry_thread, NULL);
+  if (telemetry_dropped)
+    fprintf(stderr, "telemetry: %li records dropped\n", telemetry_dropped);
+}
+
+// Hand every worker one free slot per bot in its slice
+void hand_out_slots(void)
+{
+  int t, n;
+  struct worker *w;
+
+  reserve_slots(workers[threads - 1].to - workers[0].from);
+  for (t = 0; t < threads; t++)
+  {
+    w = &workers[t];
+    n = w->to - w->from;
+    if (n > nfree)
+      n = nfree;
+    if (n > w->cap)
+    {
+      w->cap = n * 2;
+      w->reserve = (int *)realloc(w->reserve, sizeof(int) * w->cap);
+      w->born = (int *)realloc(w->born, sizeof(int) * w->cap);
+    }
+    nfree -= n;
+    memcpy(w->reserve, free_slots + nfree, sizeof(int) * n);
+    w->nreserve = n;
+    w->nborn = 0;
+  }
+}
+
+// Add the phase's births to the live list and give back the unused slots.
+// Workers are merged in thread order, and threads own contiguous runs of
+// tiles, so births are listed in tile order whatever the thread count.
+void merge_spawns(void)
+{
+  int t, i;
+  struct worker *w;
+
+  for (t = 0; t < threads; t++)
+  {
+    w = &workers[t];
+    for (i = 0; i < w->nborn; i++)
+    {
+      record_birth(&bots[w->born[i]]);
+      species_of(&bots[w->born[i]])->births++;
+    }
+    memcpy(live + last, w->born, sizeof(int) * w->nborn);
+    last += w->nborn;
+    births += w->nborn;
+    memcpy(free_slots + nfree, w->reserve, sizeof(int) * w->nreserve);
+    nfree += w->nreserve;
+    w->nborn = w->nreserve = 0;
+  }
+}
+
+// Run one instruction of every bot. The colours of the checkerboard run one
+// after the other; inside a colour the tiles are split between the
+// threads, balanced by bot count.
+void tick_compute(void)
+{
+  int c, t, r, from, to, target;
+
+  bucket_bots();
+  for (c = 0; c < colors; c++)
+  {
+    r = color_start[c];
+    from = chunk_start[color_start[c]];
+    to = chunk_start[color_start[c + 1]];
+    if (from == to)
+      continue;
+    for (t = 0; t < threads; t++)
+    {
+      // Split between tiles, never between the chunks of a folded one
+      target = from + (long)(to - from) * t / threads;
+      while (r < color_start[c + 1] &&
+             (chunk_start[r] < target || (r > color_start[c] && active[r]->key >> 2 == active[r - 1]->key >> 2)))
+        r++;
+      workers[t].from = chunk_start[r];
+      if (t > 0)
+        workers[t - 1].to = workers[t].from;
+    }
+    workers[threads - 1].to = to;
+    hand_out_slots();
+    if (threads > 1)
+    {
+      pthread_barrier_wait(&phase_start);
+      run_tiles(&workers[0]);
+      pthread_barrier_wait(&phase_done);
+    }
+    else
+      run_tiles(&workers[0]);
+    merge_spawns();
+  }
+}
+
+// Removes the bots that ran out of energy or age, and returns the energy of
+// the living. The population and energy of each species are summed on the
+// way.
+float sweep_dead(void)
+{
+  float total_energy_sum = 0;
+  struct species *c;
+  int i;
+
+  for (i = 0; i < species_top; i++)
+  {
+    species[i].population = 0;
+    species[i].energy = 0;
+  }
+
+  // The grid is kept up to date by moves and births, so the sweep only has to
+  // clear the cells of the dead and give their slots back. Living bots
+  // never move in the pool; only their index in the live list changes.
+  for (i = 0; i < last; ) // Remove the increment from here
+  {
+    struct bot *bt = &bots[live[i]];
+    c = species_of(bt);
+    if (bt->energy > 0 && bt->age > 0)
+    {
+      // Bot is alive, nothing to do on the grid
+      total_energy_sum += bt->energy;
+      c->population++;
+      c->energy += bt->energy;
+      i++; // Move to the next bot only if the current bot is not removed
+    }
+    else
+    {
+      // Bot is dead, clear its cell
+      c->deaths++;
+      set_cell(bt->p, NO_BOT);
+      free_bot(bt);
+      ++deaths;
+
+      // Fill the hole in the live list with its last entry and check that
+      // one next
+      live[i] = live[--last];
+    }
+  }
+  release_chunks();
+  return total_energy_sum;
+}
+
+// Food is random bots with plenty of energy, dropped on empty cells
+void drop_food(void)
+{
+  signed char g[MEM_SIZE];
+  struct bot *b;
+  int i;
+  long long position;
+
+  unsigned long long seed;
+
+  // Every strip of a --procs run makes the same draws and keeps the food
+  // that lands in its own rows
+  while (rng_below(&world_rng, 100) < food)
+  {
+    position = POS(rng_below(&world_rng, sx), rng_below(&world_rng, sy));
+    for (i = 0; i < MEM_SIZE; i++)
+    {
+      g[i] = rng_below(&world_rng, 20);
+    }
+    seed = rng_split(&world_rng);
+    if (owns(position) && cell(position) == NO_BOT && (b = new_bot()) != NULL)
+    {
+      set_cell(position, b->self);
+      live[last++] = b->self & SLOT_MASK;
+      set_bot(b, NULL, position, 100000, g, 0, seed);
+      record_birth(b);
+      species_of(b)->births++;
+      ++births;
+    }
+  }
+}
+
+void reset_bot(struct bot *b) {
+  b->p = 0;
+  b->lp = 0;
+  b->energy = 0.0;
+  b->genome = 0;
+  for (int i = 0; i < MEM_SIZE; i++) {
+    b->memory[i] = 0;
+    b->new_gcode[i] = 0;
+  }
+  b->nl = b->spilled = 0;
+  memset(b->loops, 0, sizeof(b->loops));
+  b->ptr = 0;
+  b->pos = 0;
+  b->dir = 0;
+  b->age = 0;
+  b->generation = 0;
+  b->last_adr = 0;
+  b->dad = NO_BOT;
+}
+
+// Seconds on a monotonic clock, used for the run summary
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Phase timers: how long each part of the main loop takes, kept as a
+// histogram of log2 nanoseconds per phase. Printed with the other stats on
+// the S key or SIGUSR1, and at exit in headless mode. The phases from
+// PHASE_DRAW on are timed by the render thread and are not part of a tick;
+// they are printed without a lock, so a figure may be a frame out of date.
+enum
+{
+  PHASE_COMPUTE, // tick_compute()
+  PHASE_SNAPSHOT, // publish_frame()
+  PHASE_SWEEP, // sweep_dead()
+  PHASE_BEST, // best bot scan and the G key
+  PHASE_FOOD, // drop_food()
+  PHASE_LOG, // telemetry and checkpoints
+  PHASE_FRAMES, // export_frames()
+  PHASE_EVENTS, // handle_events()
+  PHASE_DRAW, // draw_frame()
+  PHASE_SHOW, // show_frame()
+  PHASES
+};
+
+struct phase_timer
+{
+  long long count, total, max; // ns
+  long long hist[64]; // hist[i] counts times from 2^i to 2^(i+1) - 1 ns
+};
+
+struct phase_timer phase_timers[PHASES];
+
+long long now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Charges the time since "start" to phase p and returns the time now, which
+// is where the next phase starts
+long long end_phase(int p, long long start)
+{
+  long long t = now_ns(), d = t - start;
+  struct phase_timer *pt = &phase_timers[p];
+
+  pt->count++;
+  pt->total += d;
+  if (d > pt->max)
+    pt->max = d;
+  pt->hist[d > 0 ? 63 - __builtin_clzll(d) : 0]++;
+  return t;
+}
+
+// Upper end of the histogram bucket holding the q-th fraction of the times
+double phase_quantile(struct phase_timer *pt, double q)
+{
+  long long seen = 0;
+  int i;
+
+  for (i = 0; i < 63; i++)
+    if ((seen += pt->hist[i]) >= q * pt->count)
+      break;
+  return (double)(2LL << i);
+}
+
+void print_phase_times(void)
+{
+  static const char *names[PHASES] = {"compute", "snapshot", "sweep", "best", "food", "log", "frames", "events", "draw", "show"};
+  long long total = 0;
+  int p;
+
+  for (p = 0; p < PHASE_DRAW; p++)
+    total += phase_timers[p].total;
+  printf("Tick phases at tick %i, in microseconds (p50 and p99 are upper bounds)\n", tick);
+  printf("  %-8s %10s %10s %10s %10s %7s\n", "phase", "mean", "p50", "p99", "max", "share");
+  for (p = 0; p < PHASES; p++)
+  {
+    struct phase_timer *pt = &phase_timers[p];
+    if (pt->count == 0)
+      continue;
+    printf("  %-8s %10.1f %10.1f %10.1f %10.1f", names[p], pt->total / 1e3 / pt->count,
+           phase_quantile(pt, 0.5) / 1e3, phase_quantile(pt, 0.99) / 1e3, pt->max / 1e3);
+    if (p < PHASE_DRAW)
+      printf(" %6.2f%%\n", total ? 100.0 * pt->total / total : 0);
+    else
+      printf(" %7s\n", "-");
+  }
+}
+
+void stop_running(int sig)
+{
+  (void)sig;
+  keypress = 1;
+}
+
+void request_stats(int sig)
+{
+  (void)sig;
+  show_stats = 1;
+}
+
+// Sums the counters of all workers, so only call it between ticks
+void print_vm_stats(void)
+{
+#ifdef VM_STATS
+  static const char *names[OP_HALT + 1] = {
+    "no-op", "ptr++", "ptr--", "memory++", "memory--", "loop", "end loop", "sense", "read dir", "write gene",
+    "turn right", "turn left", "forward", "back", "reproduce", "mate", "attack", "share", "build", "copy gene",
+    "halted"};
+  struct vm_stats sum;
+  long long total = 0;
+  int t, i, j;
+
+  memset(&sum, 0, sizeof(sum));
+  for (t = 0; t < threads; t++)
+  {
+    for (i = 0; i <= OP_HALT; i++)
+    {
+      sum.executed[i] += workers[t].stats.executed[i];
+      sum.ok[i] += workers[t].stats.ok[i];
+      sum.halted[i] += workers[t].stats.halted[i];
+    }
+    for (j = 0; j < 3; j++)
+      sum.sensed[j] += workers[t].stats.sensed[j];
+  }
+  for (i = 0; i <= OP_HALT; i++)
+    total += sum.executed[i];
+  printf("VM stats at tick %i, %lli instructions\n", tick, total);
+  for (i = 0; i <= OP_HALT; i++)
+  {
+    printf("%4i %-11s %14lli %6.2f%%", i, names[i], sum.executed[i], total ? 100.0 * sum.executed[i] / total : 0);
+    switch (i)
+    {
+      case 1:
+      case 2:
+        printf("  pointer left the memory %lli", sum.halted[i]);
+        break;
+      case 5:
+        printf("  loop stack full %lli", sum.halted[i]);
+        break;
+      case 6:
+        printf("  jumped back %lli", sum.ok[i]);
+        break;
+      case 7:
+        printf("  nothing %lli, other %lli, compatible %lli", sum.sensed[0], sum.sensed[1], sum.sensed[2]);
+        break;
+      case 12:
+      case 13:
+        printf("  moved %lli, blocked %lli", sum.ok[i], sum.executed[i] - sum.ok[i]);
+        break;
+      case 14:
+      case 15:
+      case 18:
+        printf("  born %lli, failed %lli", sum.ok[i], sum.executed[i] - sum.ok[i]);
+        break;
+      case 16:
+      case 17:
+        printf("  done %lli, not done %lli", sum.ok[i], sum.executed[i] - sum.ok[i]);
+        break;
+    }
+    printf("\n");
+  }
+#endif
+}
+
+// Multi-process mode (--procs N, headless): the world is cut into N strips
+// of rows, each run by its own process with its own bots, genomes and
+// chunks, so each strip has an address space of its own and its memory
+// stays on the node it first touched it from. Bots see the row past each
+// edge of their strip as ghosts, copies of the neighbours' edge bots as of
+// the last exchange. After every tick each strip sends each neighbour
+// - the bots that moved or were born into its rows, which it takes in if the
+//   cell is still free; a migrant that finds its cell taken is lost,
+// - the energy its bots took from or gave to that neighbour's ghosts, and
+// - its edge row, as that neighbour's new ghosts,
+// through buffers in shared memory. The parent process coordinates: it
+// merges the stats of the strips for telemetry and the summary, and tells
+// them when to stop. A run is reproducible for a given seed and --procs.
+struct ghost
+{
+  long long p;
+  unsigned int self; // handle in the strip that owns it
+  float energy;
+  short generation;
+  signed char gcode[MEM_SIZE];
+};
+
+struct migrant
+{
+  struct bot bot;
+  signed char gcode[MEM_SIZE];
+  unsigned char loops[MAX_LOUPS - LOOP_INLINE][2]; // the bot's spilled loop entries
+};
+
+struct energy_delta
+{
+  unsigned int self;
+  float delta;
+};
+
+// What a strip sends one neighbour in a tick. Each list is at most a row.
+struct halo
+{
+  int nghosts, nmigrants, ndeltas;
+  struct ghost *ghosts;
+  struct migrant *migrants;
+  struct energy_delta *deltas;
+};
+
+struct strip_stats
+{
+  int population;
+  int genomes; // how many of gcodes[] are filled, see count_genomes()
+  signed char (*gcodes)[MEM_SIZE]; // the strip's distinct genomes
+  float energy, best_energy;
+  long births, deaths;
+  signed char best_gcode[MEM_SIZE];
+};
+
+struct shared_run
+{
+  pthread_barrier_t sent, received;
+  int stop;
+  int count; // the strips hand over their genomes this tick, see count_genomes()
+};
+
+int procs = 1; // --procs
+struct shared_run *shared;
+struct strip_stats *strip_stats;
+struct halo *halos; // 2 * procs: halos[2 * s] goes up from strip s, halos[2 * s + 1] down
+pid_t *strip_pids;
+
+// This strip's ghosts: their slots, and the energy and owner they came with
+struct ghost_slot
+{
+  int slot;
+  float energy;
+  unsigned int owner;
+};
+struct ghost_slot *ghost_slots;
+int nghost_slots = 0;
+
+void *shared_alloc(size_t size)
+{
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+// First row of strip s
+int strip_row(int s)
+{
+  return (long)sy * s / procs;
+}
+
+// Strip next to s, or -1 at the edge of a world that does not wrap
+int strip_above(int s)
+{
+  return s > 0 ? s - 1 : wrap ? procs - 1 : -1;
+}
+
+int strip_below(int s)
+{
+  return s < procs - 1 ? s + 1 : wrap ? 0 : -1;
+}
+
+// Sends the neighbours of strip s what changed on their side in this tick,
+// and this strip's stats to the coordinator
+void send_halo(int s)
+{
+  struct halo *up = strip_above(s) >= 0 ? &halos[2 * s] : NULL;
+  struct halo *down = strip_below(s) >= 0 ? &halos[2 * s + 1] : NULL;
+  struct halo *h;
+  struct strip_stats *st = &strip_stats[s];
+  struct bot *b;
+  int i, y, in_flight, id;
+
+  if (up != NULL)
+    up->nghosts = up->nmigrants = up->ndeltas = 0;
+  if (down != NULL)
+    down->nghosts = down->nmigrants = down->ndeltas = 0;
+
+  // Energy taken from or given to ghosts goes back to their owners
+  for (i = 0; i < nghost_slots; i++)
+  {
+    b = &bots[ghost_slots[i].slot];
+    h = POS_Y(b->p) == (strip_y0 + sy - 1) % sy ? up : down;
+    if (b->energy != ghost_slots[i].energy)
+    {
+      h->deltas[h->ndeltas].self = ghost_slots[i].owner;
+      h->deltas[h->ndeltas++].delta = b->energy - ghost_slots[i].energy;
+    }
+    set_cell(b->p, NO_BOT);
+    free_bot(b);
+  }
+  nghost_slots = 0;
+
+  for (i = 0; i < last;)
+  {
+    b = &bots[live[i]];
+    y = POS_Y(b->p);
+    if (y < strip_y0 || y >= strip_y1)
+    {
+      // Moved or was born past the edge
+      h = y == (strip_y0 + sy - 1) % sy ? up : down;
+      h->migrants[h->nmigrants].bot = *b;
+      if (b->spilled)
+        memcpy(h->migrants[h->nmigrants].loops, loop_spills[live[i]].loops, 2 * b->spilled);
+      memcpy(h->migrants[h->nmigrants++].gcode, gcode_of(b), MEM_SIZE);
+      set_cell(b->p, NO_BOT);
+      free_bot(b);
+      live[i] = live[--last];
+      continue;
+    }
+    // Edge rows are the neighbours' ghosts. Strips have at least 3 rows,
+    // so a bot is on one edge at most.
+    h = y == strip_y0 ? up : y == strip_y1 - 1 ? down : NULL;
+    if (h != NULL)
+    {
+      h->ghosts[h->nghosts].p = b->p;
+      h->ghosts[h->nghosts].self = b->self;
+      h->ghosts[h->nghosts].energy = b->energy;
+      h->ghosts[h->nghosts].generation = b->generation;
+      memcpy(h->ghosts[h->nghosts++].gcode, gcode_of(b), MEM_SIZE);
+    }
+    i++;
+  }
+
+  // Migrants are counted here until their new strip has them
+  in_flight = (up != NULL ? up->nmigrants : 0) + (down != NULL ? down->nmigrants : 0);
+  st->population = last + in_flight;
+  if (shared->count)
+  {
+    st->genomes = 0;
+    for (id = 1; id < genome_top; id++)
+      if (genome_at(id)->refs > 0)
+        memcpy(st->gcodes[st->genomes++], genome_at(id)->gcode, MEM_SIZE);
+  }
+  st->births = births;
+  st->deaths = deaths;
+  st->best_energy = best_energy;
+  if ((b = resolve(best)) != NULL)
+    memcpy(st->best_gcode, gcode_of(b), sizeof(st->best_gcode));
+  else
+    memset(st->best_gcode, 0, sizeof(st->best_gcode));
+}
+
+// Takes in what the neighbours of strip s sent it
+void receive_halo(int s)
+{
+  struct halo *from[2];
+  struct migrant *m;
+  struct ghost *g;
+  struct bot *b;
+  unsigned int self;
+  unsigned char gen;
+  int i, j, id, n = 0;
+
+  from[0] = strip_above(s) >= 0 ? &halos[2 * strip_above(s) + 1] : NULL;
+  from[1] = strip_below(s) >= 0 ? &halos[2 * strip_below(s)] : NULL;
+  for (j = 0; j < 2; j++)
+  {
+    if (from[j] == NULL)
+      continue;
+    for (i = 0; i < from[j]->ndeltas; i++)
+      if ((b = resolve(from[j]->deltas[i].self)) != NULL)
+        b->energy += from[j]->deltas[i].delta;
+    for (i = 0; i < from[j]->nmigrants; i++)
+    {
+      m = &from[j]->migrants[i];
+      // new_bot() takes the slot on top of free_slots
+      if (cell(m->bot.p) != NO_BOT || !reserve_slots(1) || !reserve_loops(free_slots[nfree - 1], m->bot.spilled) ||
+          (b = new_bot()) == NULL)
+      {
+        // Dies on arrival, counted in its species here as sweep_dead() would
+        id = intern_genome(m->gcode);
+        species[genome_at(id)->species].deaths++;
+        release_genome(id);
+        ++deaths;
+        continue;
+      }
+      self = b->self;
+      gen = b->gen;
+      *b = m->bot;
+      b->self = self;
+      b->gen = gen;
+      b->genome = intern_genome(m->gcode);
+      b->species = genome_at(b->genome)->species;
+      b->dad = b->mom = NO_BOT; // handles from the other strip mean nothing here
+      if (b->spilled)
+        memcpy(loop_spills[self & SLOT_MASK].loops, m->loops, 2 * b->spilled);
+      set_cell(b->p, self);
+      live[last++] = self & SLOT_MASK;
+    }
+    n += from[j]->nghosts;
+  }
+
+  ghost_slots = (struct ghost_slot *)realloc(ghost_slots, sizeof(struct ghost_slot) * (n + 1));
+  for (j = 0; j < 2; j++)
+    for (i = 0; from[j] != NULL && i < from[j]->nghosts; i++)
+    {
+      g = &from[j]->ghosts[i];
+      if ((b = new_bot()) == NULL)
+        break;
+      set_bot(b, NULL, g->p, g->energy, g->gcode, g->generation - 1, 0);
+      set_cell(g->p, b->self);
+      ghost_slots[nghost_slots].slot = b->self & SLOT_MASK;
+      ghost_slots[nghost_slots].energy = g->energy;
+      ghost_slots[nghost_slots++].owner = g->self;
+    }
+}
+
+// A strip process: the main loop without the window, the lineage,
+// checkpoints and telemetry, plus the exchange
+void run_strip(int s)
+{
+  int i;
+
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_IGN);
+  strip_y0 = strip_row(s);
+  strip_y1 = strip_row(s + 1);
+  init_workers();
+  start_workers();
+  for (;;)
+  {
+    ++tick;
+    tick_compute();
+    strip_stats[s].energy = sweep_dead();
+    // A best bot that died or migrated away is replaced at the next scan
+    if (resolve(best) == NULL)
+      best_energy = 0;
+    if (tick % 10 == 0)
+      for (i = 0; i < last; i++)
+        if (bots[live[i]].energy > best_energy && bots[live[i]].generation > 20)
+        {
+          best = bots[live[i]].self;
+          best_energy = bots[live[i]].energy;
+        }
+    drop_food();
+    send_halo(s);
+    pthread_barrier_wait(&shared->sent);
+    receive_halo(s);
+    pthread_barrier_wait(&shared->received);
+    if (shared->stop)
+      break;
+  }
+  stop_workers();
+  _exit(0);
+}
+
+// Adds g to "table", an open addressed set of size entries (a power of
+// two), and returns 1 if it was not in it yet
+int add_distinct(signed char **table, int size, signed char *g)
+{
+  unsigned int i;
+
+  for (i = hash_genome(g);; i++)
+  {
+    if (table[i & (size - 1)] == NULL)
+    {
+      table[i & (size - 1)] = g;
+      return 1;
+    }
+    if (!memcmp(table[i & (size - 1)], g, MEM_SIZE))
+      return 0;
+  }
+}
+
+// Distinct genomes in all the strips and in the migrants between them. A
+// genome can live in several strips at once, so the strips hand over their
+// genomes and only the coordinator counts.
+int count_genomes(void)
+{
+  signed char **table;
+  struct halo *h;
+  int n = 0, size = 2, distinct = 0, s, i;
+
+  for (s = 0; s < procs; s++)
+    n += strip_stats[s].genomes + halos[2 * s].nmigrants + halos[2 * s + 1].nmigrants;
+  while (size < 2 * n)
+    size *= 2;
+  table = (signed char **)calloc(size, sizeof(*table));
+  for (s = 0; s < procs; s++)
+  {
+    for (i = 0; i < strip_stats[s].genomes; i++)
+      distinct += add_distinct(table, size, strip_stats[s].gcodes[i]);
+    for (h = &halos[2 * s]; h <= &halos[2 * s + 1]; h++)
+      for (i = 0; i < h->nmigrants; i++)
+        distinct += add_distinct(table, size, h->migrants[i].gcode);
+  }
+  free(table);
+  return distinct;
+}
+
+// A strip that ends before the run does leaves the others and the
+// coordinator waiting at the barriers for good, so all of them go
+void strip_died(int sig)
+{
+  int s;
+
+  (void)sig;
+  if (shared->stop)
+    return;
+  for (s = 0; s < procs; s++)
+    if (strip_pids[s] > 0 && waitpid(strip_pids[s], NULL, WNOHANG) == strip_pids[s])
+      break;
+  if (s == procs)
+    return;
+  for (s = 0; s < procs; s++)
+    if (strip_pids[s] > 0)
+      kill(strip_pids[s], SIGKILL);
+  if (write(2, "--procs: a strip died, stopping\n", 32) < 0)
+    _exit(2);
+  _exit(1);
+}
+
+// Forks the strips and coordinates them until max_ticks or a signal. The
+// world is set up but empty; telemetry is started here, after the fork.
+int run_procs(long max_ticks)
+{
+  pthread_barrierattr_t attr;
+  struct strip_stats total;
+  size_t ghosts = sizeof(struct ghost) * sx, migrants = sizeof(struct migrant) * sx, gcodes;
+  sigset_t chld;
+  pid_t coordinator = getpid();
+  double start;
+  int s, best_strip, telemetry_ok;
+
+  if (sy / procs < 3)
+  {
+    fprintf(stderr, "--procs %i: strips need at least 3 rows each\n", procs);
+    return 0;
+  }
+  shared = (struct shared_run *)shared_alloc(sizeof(struct shared_run));
+  strip_stats = (struct strip_stats *)shared_alloc(sizeof(struct strip_stats) * procs);
+  halos = (struct halo *)shared_alloc(sizeof(struct halo) * 2 * procs);
+  if (shared == NULL || strip_stats == NULL || halos == NULL)
+  {
+    perror("--procs");
+    return 0;
+  }
+  for (s = 0; s < 2 * procs; s++)
+    if ((halos[s].ghosts = (struct ghost *)shared_alloc(ghosts)) == NULL ||
+        (halos[s].migrants = (struct migrant *)shared_alloc(migrants)) == NULL ||
+        (halos[s].deltas = (struct energy_delta *)shared_alloc(sizeof(struct energy_delta) * sx)) == NULL)
+    {
+      perror("--procs");
+      return 0;
+    }
+  // A strip never holds more genomes than cells
+  for (s = 0; s < procs; s++)
+  {
+    gcodes = (size_t)sx * (strip_row(s + 1) - strip_row(s));
+    if (gcodes > MAX_SLOTS)
+      gcodes = MAX_SLOTS;
+    if ((strip_stats[s].gcodes = (signed char (*)[MEM_SIZE])shared_alloc(MEM_SIZE * gcodes)) == NULL)
+    {
+      perror("--procs");
+      return 0;
+    }
+  }
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(&shared->sent, &attr, procs + 1);
+  pthread_barrier_init(&shared->received, &attr, procs + 1);
+  shared->count = max_ticks == 1;
+
+  // SIGCHLD waits until every pid is known to strip_died()
+  strip_pids = (pid_t *)calloc(procs, sizeof(pid_t));
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, NULL);
+  signal(SIGCHLD, strip_died);
+  for (s = 0; s < procs; s++)
+  {
+    if ((strip_pids[s] = fork()) == 0)
+    {
+      signal(SIGCHLD, SIG_DFL);
+      sigprocmask(SIG_UNBLOCK, &chld, NULL);
+#ifdef __linux__
+      // Nor may a coordinator that dies leave the strips waiting
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+      if (getppid() != coordinator)
+        _exit(1);
+      run_strip(s);
+    }
+    if (strip_pids[s] < 0)
+    {
+      perror("fork");
+      signal(SIGCHLD, SIG_DFL);
+      while (s-- > 0)
+      {
+        kill(strip_pids[s], SIGKILL);
+        waitpid(strip_pids[s], NULL, 0);
+      }
+      sigprocmask(SIG_UNBLOCK, &chld, NULL);
+      return 0;
+    }
+  }
+  sigprocmask(SIG_UNBLOCK, &chld, NULL);
+  telemetry_ok = start_telemetry();
+  if (!telemetry_ok)
+    shared->stop = 1;
+
+  start = now();
+  do
+  {
+    pthread_barrier_wait(&shared->sent);
+    ++tick;
+    memset(&total, 0, sizeof(total));
+    for (s = best_strip = 0; s < procs; s++)
+    {
+      total.population += strip_stats[s].population;
+      total.energy += strip_stats[s].energy;
+      total.births += strip_stats[s].births;
+      total.deaths += strip_stats[s].deaths;
+      if (strip_stats[s].best_energy > strip_stats[best_strip].best_energy)
+        best_strip = s;
+    }
+    // Genomes are only handed over on the ticks they are counted, so a
+    // keypress stops the run at the next of those
+    if (shared->count && (keypress || (max_ticks && tick >= max_ticks)))
+      shared->stop = 1;
+    if (shared->count)
+      total.genomes = count_genomes();
+    if (tick % 10 == 0 && telemetry_ok)
+      push_telemetry(total.population, total.energy, total.genomes, strip_stats[best_strip].best_gcode);
+    shared->count = (tick + 1) % 10 == 0 || keypress || (max_ticks && tick + 1 >= max_ticks);
+    pthread_barrier_wait(&shared->received);
+  } while (!shared->stop);
+  // Not wait(): the gzip behind --telemetry-gzip is a child too
+  for (s = 0; s < procs; s++)
+    waitpid(strip_pids[s], NULL, 0);
+  signal(SIGCHLD, SIG_DFL);
+
+  printf("ticks %i, seconds %.3f, ticks/s %.1f, population %i, energy %f, births %li, deaths %li, genomes %i, procs %i\n",
+         tick, now() - start, tick / (now() - start), total.population, total.energy, total.births, total.deaths,
+         total.genomes, procs);
+  if (!telemetry_ok)
+    return 0;
+  stop_telemetry();
+  return 1;
+}
+
+void usage(char *name)
+{
+  fprintf(stderr, "usage: %s [--headless] [--ticks N] [--seed S] [--threads N] [--slice K] [--lineage FILE]\n"
+                  "          [--procs N] [--ensemble FILE] [--ensemble-out FILE]\n"
+                  "          [--ensemble-every N] [--pool N] [--size WxH] [--wrap]\n"
+                  "          [--food N] [--mutation N] [--max-age N]\n"
+                  "          [--checkpoint FILE] [--checkpoint-every N] [--restore FILE]\n"
+                  "          [--telemetry FILE] [--telemetry-gzip] [--telemetry-rotate MB]\n"
+                  "          [--frames PREFIX] [--frames-every N] [--frames-scale LIST]\n"
+                  "          [--frames-stream] [--view V]\n"
+                  "          [--fps F] [--frame-every N] [--bench]\n", name);
+  fprintf(stderr, "  --headless  run without opening a window (no SDL calls at all)\n");
+  fprintf(stderr, "  --ticks N   stop after N ticks and print a summary (0 = run forever)\n");
+  fprintf(stderr, "  --seed S    seed the random generator (default: current time)\n");
+  fprintf(stderr, "  --size WxH  world of W x H cells, and a window that size (default:\n");
+  fprintf(stderr, "              1200x1000); memory and time follow the cells with bots\n");
+  fprintf(stderr, "  --wrap      join the edges of the world, making it a torus\n");
+  fprintf(stderr, "  --food N    chance in 100 of each further food bot in a tick, up to 99\n");
+  fprintf(stderr, "              (default: 40)\n");
+  fprintf(stderr, "  --mutation N  mutations per 1000 copied opcodes (default: 20)\n");
+  fprintf(stderr, "  --max-age N  instructions a bot can run in its life (default: 2000)\n");
+  fprintf(stderr, "  --threads N run the tick on N threads (default: 1)\n");
+  fprintf(stderr, "  --procs N   split the world into N strips of rows, each run by a\n");
+  fprintf(stderr, "              process of its own, bots crossing and seeing across the\n");
+  fprintf(stderr, "              edges once a tick (headless, without --lineage,\n");
+  fprintf(stderr, "              --checkpoint, --restore or --frames)\n");
+  fprintf(stderr, "  --ensemble FILE  run a world per line of FILE, \"food mutation seed\"\n");
+  fprintf(stderr, "              and optionally a max-age, for --ticks N each, up to\n");
+  fprintf(stderr, "              --pool N at a time (default: one per CPU), sampling every\n");
+  fprintf(stderr, "              --ensemble-every N ticks (default: 100) into\n");
+  fprintf(stderr, "              --ensemble-out FILE (default: ensemble.txt); ensemble\n");
+  fprintf(stderr, "              build only (make ensemble), where --threads is always 1\n");
+  fprintf(stderr, "  --slice K   let each bot run up to K instructions per tick, stopping\n");
+  fprintf(stderr, "              after one that touches the world (default: 1)\n");
+  fprintf(stderr, "  --lineage FILE  record every birth to FILE (see lineage_reader.py)\n");
+  fprintf(stderr, "  --checkpoint FILE  save the world to FILE in the background every\n");
+  fprintf(stderr, "              --checkpoint-every N ticks (default: 10000) and at exit\n");
+  fprintf(stderr, "  --restore FILE  start from a checkpoint instead of an empty world,\n");
+  fprintf(stderr, "              keeping its size and --wrap; --ticks counts from there,\n");
+  fprintf(stderr, "              --seed starts a new branch, --food, --mutation and\n");
+  fprintf(stderr, "              --max-age change its rules and --lineage FILE carries on\n");
+  fprintf(stderr, "              that run's lineage file\n");
+  fprintf(stderr, "  --telemetry FILE  append a record every 10 ticks to FILE (default:\n");
+  fprintf(stderr, "              data.bin; see telemetry_reader.py), gzipped with\n");
+  fprintf(stderr, "              --telemetry-gzip, moved to FILE.1, FILE.2, ... and\n");
+  fprintf(stderr, "              started over every --telemetry-rotate MB\n");
+  fprintf(stderr, "  --frames PREFIX  write the world as PREFIX-TICK-xS.ppm every\n");
+  fprintf(stderr, "              --frames-every N ticks (default: 100) at each scale S of\n");
+  fprintf(stderr, "              --frames-scale LIST (default: 1; e.g. 1,4,16), where\n");
+  fprintf(stderr, "              S > 1 averages S x S cells and adds a -density.pgm;\n");
+  fprintf(stderr, "              --frames-stream appends them all to PREFIX-xS.ppm\n");
+  fprintf(stderr, "  --view V    start in view V (0-5, as the V key cycles them)\n");
+  fprintf(stderr, "  --fps F     draw the window at most F times a second (default: 30)\n");
+  fprintf(stderr, "  --frame-every N  draw every Nth tick, holding the simulation back\n");
+  fprintf(stderr, "              if the window falls behind (default: 0, draw whichever\n");
+  fprintf(stderr, "              tick is current when the window is ready)\n");
+  fprintf(stderr, "  --bench     print timings of fixed 10k, 100k and 1M bot worlds run for\n");
+  fprintf(stderr, "              --ticks N ticks (default: 100, seed 1) and of the hot\n");
+  fprintf(stderr, "              functions on their own, as JSON, and exit; worlds\n");
+  fprintf(stderr, "              are capped at half the cells of --size\n");
+}
+
+// Colour of bot b in the current view as 0xRRGGBB, or -1 if the view
+// leaves it out. Same colours as the old per-pixel SDL_MapRGB path: each
+// channel is clamped to 255 and a negative one hides the bot.
+int rgb(int r, int g, int b)
+{
+  if (r < 0 || g < 0 || b < 0)
+    return -1;
+  return (r > 255 ? 255 : r) << 16 | (g > 255 ? 255 : g) << 8 | (b > 255 ? 255 : b);
+}
+
+int bot_rgb(struct bot *b)
+{
+  struct genome *e = genome_at(b->genome);
+  switch (view)
+  {
+    case 0:
+      return rgb(e->r, e->g, e->b);
+    case 1:
+      return rgb(b->energy, b->energy / 10.0, b->energy / 100.0);
+    case 2:
+      return rgb(b->age / max_age * 255, b->age / max_age * 255, b->age / max_age * 255);
+    case 3:
+      if (b->generation > 2)
+        return rgb(b->generation / 100.0, b->generation / 100.0, b->generation / 100.0);
+      return -1;
+    case 4:
+      if (b->generation > 1)
+        return rgb(e->r, e->g, e->b);
+      return -1;
+    case 5:
+      // Shared by every bot with this genome, see score_genomes()
+      return rgb(e->comp, e->comp, e->comp);
+  }
+  return -1;
+}
+
+// Pictures of the world without a window (--frames PREFIX): every
+// frames_every ticks, one binary PPM per scale in the current view, named
+// PREFIX-TICK-xS.ppm, or appended to PREFIX-xS.ppm with --frames-stream
+// (a stream of PPMs, as "ffmpeg -f image2pipe" reads). At scale S > 1 each
+// pixel is the mean colour of the bots drawn in its S x S cells, and a PGM
+// next to it (-density) shows how many cells of the block hold one, drawn
+// in the current view or not. All
+// scales are summed in one pass over the live bots.
+#define MAX_SCALES 4
+
+struct frame_scale
+{
+  int s, w, h;
+  int *sum; // r, g, b, bots drawn and all bots per pixel
+  unsigned char *row;
+  FILE *stream, *density_stream; // --frames-stream
+};
+
+char *frames_prefix = NULL;
+int frames_every = 100, frames_stream = 0;
+struct frame_scale frame_scales[MAX_SCALES] = {{1}};
+int nscales = 1;
+
+// Parses the --frames-scale list, e.g. "1,4,16"
+int parse_scales(char *list)
+{
+  char *p = list;
+  int s;
+
+  nscales = 0;
+  while (*p)
+  {
+    s = strtol(p, &p, 10);
+    if (s < 1 || nscales == MAX_SCALES || (*p && *p++ != ','))
+      return 0;
+    frame_scales[nscales++].s = s;
+  }
+  return nscales > 0;
+}
+
+FILE *open_frame(struct frame_scale *f, int density)
+{
+  char name[1024];
+
+  if (frames_stream)
+    snprintf(name, sizeof(name), "%s-x%i%s", frames_prefix, f->s, density ? "-density.pgm" : ".ppm");
+  else
+    snprintf(name, sizeof(name), "%s-%08i-x%i%s", frames_prefix, tick, f->s, density ? "-density.pgm" : ".ppm");
+  return fopen(name, "wb");
+}
+
+void export_frames(void)
+{
+  struct frame_scale *f;
+  FILE *out;
+  int i, j, c, x, y, *q, n;
+
+  for (j = 0; j < nscales; j++)
+  {
+    f = &frame_scales[j];
+    if (f->sum == NULL)
+    {
+      f->w = (sx + f->s - 1) / f->s;
+      f->h = (sy + f->s - 1) / f->s;
+      f->sum = (int *)malloc(sizeof(int) * 5 * f->w * f->h);
+      f->row = (unsigned char *)malloc((size_t)3 * f->w);
+      if (f->sum == NULL || f->row == NULL)
+      {
+        perror(frames_prefix);
+        free(f->sum);
+        free(f->row);
+        f->sum = NULL;
+        f->row = NULL;
+        frames_prefix = NULL;
+        return;
+      }
+    }
+    memset(f->sum, 0, sizeof(int) * 5 * f->w * f->h);
+  }
+  if (view == 5)
+    score_genomes();
+  for (i = 0; i < last; i++)
+  {
+    c = bot_rgb(&bots[live[i]]);
+    x = POS_X(bots[live[i]].p);
+    y = POS_Y(bots[live[i]].p);
+    for (j = 0; j < nscales; j++)
+    {
+      f = &frame_scales[j];
+      // Pixel indices of big worlds pass INT_MAX, as the malloc above does
+      q = &f->sum[5 * ((size_t)(y / f->s) * f->w + x / f->s)];
+      q[4]++;
+      if (c < 0)
+        continue;
+      q[0] += c >> 16;
+      q[1] += c >> 8 & 255;
+      q[2] += c & 255;
+      q[3]++;
+    }
+  }
+
+  for (j = 0; j < nscales; j++)
+  {
+    f = &frame_scales[j];
+    if (frames_stream && f->stream == NULL)
+    {
+      f->stream = open_frame(f, 0);
+      if (f->s > 1)
+        f->density_stream = open_frame(f, 1);
+    }
+    if ((out = frames_stream ? f->stream : open_frame(f, 0)) == NULL)
+    {
+      perror(frames_prefix);
+      frames_prefix = NULL;
+      return;
+    }
+    fprintf(out, "P6\n%i %i\n255\n", f->w, f->h);
+    for (y = 0; y < f->h; y++)
+    {
+      for (x = 0; x < f->w; x++)
+      {
+        q = &f->sum[5 * ((size_t)y * f->w + x)];
+        n = q[3] ? q[3] : 1;
+        f->row[3 * x] = q[0] / n;
+        f->row[3 * x + 1] = q[1] / n;
+        f->row[3 * x + 2] = q[2] / n;
+      }
+      fwrite(f->row, 3, f->w, out);
+    }
+    if (!frames_stream)
+      fclose(out);
+    if (f->s == 1)
+      continue;
+
+    if ((out = frames_stream ? f->density_stream : open_frame(f, 1)) == NULL)
+    {
+      perror(frames_prefix);
+      frames_prefix = NULL;
+      return;
+    }
+    fprintf(out, "P5\n%i %i\n255\n", f->w, f->h);
+    for (y = 0; y < f->h; y++)
+    {
+      for (x = 0; x < f->w; x++)
+        f->row[x] = (f->sum[5 * ((size_t)y * f->w + x) + 4] * 255 + f->s * f->s - 1) / (f->s * f->s); // rounded up, so one bot shows
+      fwrite(f->row, 1, f->w, out);
+    }
+    if (!frames_stream)
+      fclose(out);
+  }
+}
+
+void close_frames(void)
+{
+  int j;
+
+  for (j = 0; j < nscales; j++)
+  {
+    if (frame_scales[j].stream != NULL)
+      fclose(frame_scales[j].stream);
+    if (frame_scales[j].density_stream != NULL)
+      fclose(frame_scales[j].density_stream);
+  }
+}
+
+#ifndef NO_SDL
+// The window belongs to a render thread, so the simulation never waits on
+// the display. Between ticks the simulation copies what is to be drawn
+// (cell and colour of every visible bot) into one of two snapshots; the
+// render thread draws the newest one at up to --fps frames a second and
+// passes the window events back through a queue that the simulation
+// handles between ticks.
+//
+// Which ticks are drawn is set by frame_every: 0 takes a snapshot whenever
+// the render thread has taken the last one, so drawing costs the
+// simulation nothing beyond the copy; N > 0 draws every Nth tick, and the
+// simulation waits for the display when it gets ahead.
+enum
+{
+  SNAP_FREE,
+  SNAP_FILLING,
+  SNAP_READY,
+  SNAP_DRAWING
+};
+
+struct snapshot
+{
+  int *cells; // pixel, y * sx + x
+  int *colours; // 0xRRGGBB
+  int n, cap;
+  int tick;
+  int state; // SNAP_*, under render_lock
+};
+
+struct snapshot snapshots[2];
+int frame_every = 0; // --frame-every, PAGEUP/PAGEDOWN
+int fps = 30; // --fps
+int render_quit = 0, render_status = 0; // status: 0 starting, 1 running, -1 failed
+pthread_t render_thread;
+pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t render_cond = PTHREAD_COND_INITIALIZER;
+
+// Window events waiting for handle_events(), under render_lock
+#define MAX_COMMANDS 64
+SDL_Event commands[MAX_COMMANDS];
+int ncommands = 0;
+
+void take_snapshot(struct snapshot *s)
+{
+  int i, c;
+
+  if (last > s->cap)
+  {
+    s->cap = last * 2;
+    s->cells = (int *)realloc(s->cells, sizeof(int) * s->cap);
+    s->colours = (int *)realloc(s->colours, sizeof(int) * s->cap);
+  }
+  s->n = 0;
+  if (view == 5)
+    score_genomes();
+  for (i = 0; i < last; i++)
+    if ((c = bot_rgb(&bots[live[i]])) >= 0)
+    {
+      s->cells[s->n] = POS_Y(bots[live[i]].p) * sx + POS_X(bots[live[i]].p);
+      s->colours[s->n++] = c;
+    }
+  s->tick = tick;
+}
+
+// Called by the simulation between ticks
+void publish_frame(void)
+{
+  struct snapshot *s;
+  int i;
+
+  pthread_mutex_lock(&render_lock);
+  if (frame_every == 0 && (snapshots[0].state == SNAP_READY || snapshots[1].state == SNAP_READY))
+  {
+    // The last one has not been drawn yet
+    pthread_mutex_unlock(&render_lock);
+    return;
+  }
+  if (frame_every > 0)
+    while (!render_quit && (snapshots[0].state == SNAP_READY || snapshots[1].state == SNAP_READY))
+      pthread_cond_wait(&render_cond, &render_lock);
+  s = &snapshots[snapshots[0].state == SNAP_DRAWING];
+  s->state = SNAP_FILLING;
+  pthread_mutex_unlock(&render_lock);
+
+  take_snapshot(s);
+
+  pthread_mutex_lock(&render_lock);
+  for (i = 0; i < 2; i++)
+    if (snapshots[i].state == SNAP_READY)
+      snapshots[i].state = SNAP_FREE;
+  s->state = SNAP_READY;
+  pthread_cond_broadcast(&render_cond);
+  pthread_mutex_unlock(&render_lock);
+}
+
+// The screen is only ever written where something changed: shown[] holds the
+// pixel in every cell as last written, and painted[] the cells drawn in the
+// last frame. A frame draws every bot whose pixel differs from shown[] and
+// clears the cells painted last time that nobody was drawn on this time, so
+// it costs in proportion to the bots, not to the screen area.
+Uint32 *shown;
+int *drawn_at, *painted, *fresh, npainted = 0, painted_cap = 0, frame_no = 0;
+int dirty_top, dirty_bottom; // rows written by the last draw_frame()
+
+void draw_frame(SDL_Surface *screen, struct snapshot *s)
+{
+  SDL_PixelFormat *f = screen->format;
+  Uint32 *pixels, px;
+  int i, p, c, n = 0, pitch;
+  int *swap;
+
+  if (shown == NULL)
+  {
+    shown = (Uint32 *)calloc(sx * sy, sizeof(Uint32));
+    drawn_at = (int *)calloc(sx * sy, sizeof(int));
+  }
+  if (s->n > painted_cap)
+  {
+    painted_cap = s->n * 2 < sx * sy ? s->n * 2 : sx * sy;
+    painted = (int *)realloc(painted, sizeof(int) * painted_cap);
+    fresh = (int *)realloc(fresh, sizeof(int) * painted_cap);
+  }
+  if (SDL_MUSTLOCK(screen))
+    SDL_LockSurface(screen);
+  pixels = (Uint32 *)screen->pixels;
+  pitch = screen->pitch / 4;
+  dirty_top = sy;
+  dirty_bottom = -1;
+  ++frame_no;
+  for (i = 0; i < s->n; i++)
+  {
+    p = s->cells[i];
+    c = s->colours[i];
+    px = (Uint32)(c >> 16) << f->Rshift | (Uint32)(c >> 8 & 255) << f->Gshift | (Uint32)(c & 255) << f->Bshift;
+    drawn_at[p] = frame_no;
+    fresh[n++] = p;
+    if (shown[p] != px)
+    {
+      shown[p] = px;
+      pixels[p / sx * pitch + p % sx] = px;
+      if (p / sx < dirty_top)
+        dirty_top = p / sx;
+      if (p / sx > dirty_bottom)
+        dirty_bottom = p / sx;
+    }
+  }
+  for (i = 0; i < npainted; i++)
+  {
+    p = painted[i];
+    if (drawn_at[p] != frame_no && shown[p] != 0)
+    {
+      shown[p] = 0;
+      pixels[p / sx * pitch + p % sx] = 0;
+      if (p / sx < dirty_top)
+        dirty_top = p / sx;
+      if (p / sx > dirty_bottom)
+        dirty_bottom = p / sx;
+    }
+  }
+  swap = painted;
+  painted = fresh;
+  fresh = swap;
+  npainted = n;
+  if (SDL_MUSTLOCK(screen))
+    SDL_UnlockSurface(screen);
+}
+
+// Shows the rows draw_frame() wrote to
+void show_frame(SDL_Surface *screen)
+{
+  if (dirty_bottom >= dirty_top)
+    SDL_UpdateRect(screen, 0, dirty_top, sx, dirty_bottom - dirty_top + 1);
+}
+
+void *render_main(void *arg)
+{
+  SDL_Surface *screen = NULL;
+  SDL_Event event;
+  struct snapshot *s;
+  long long frame_start, t;
+  int ok;
+
+  (void)arg;
+  ok = SDL_Init(SDL_INIT_VIDEO) == 0 && (screen = SDL_SetVideoMode(sx, sy, DEPTH, SDL_HWSURFACE)) != NULL;
+  pthread_mutex_lock(&render_lock);
+  render_status = ok ? 1 : -1;
+  pthread_cond_broadcast(&render_cond);
+  pthread_mutex_unlock(&render_lock);
+  if (!ok)
+  {
+    SDL_Quit();
+    return NULL;
+  }
+
+  while (!__atomic_load_n(&render_quit, __ATOMIC_ACQUIRE))
+  {
+    frame_start = now_ns();
+    while (SDL_PollEvent(&event))
+    {
+      // A full queue drops the event, unless it is the one that closes the window
+      pthread_mutex_lock(&render_lock);
+      if (ncommands < MAX_COMMANDS)
+        commands[ncommands++] = event;
+      else if (event.type == SDL_QUIT)
+        commands[MAX_COMMANDS - 1] = event;
+      pthread_mutex_unlock(&render_lock);
+    }
+
+    pthread_mutex_lock(&render_lock);
+    s = snapshots[0].state == SNAP_READY ? &snapshots[0] : snapshots[1].state == SNAP_READY ? &snapshots[1] : NULL;
+    if (s != NULL)
+      s->state = SNAP_DRAWING;
+    pthread_mutex_unlock(&render_lock);
+    if (s != NULL)
+    {
+      t = now_ns();
+      draw_frame(screen, s);
+      t = end_phase(PHASE_DRAW, t);
+      show_frame(screen);
+      end_phase(PHASE_SHOW, t);
+      pthread_mutex_lock(&render_lock);
+      s->state = SNAP_FREE;
+      pthread_cond_broadcast(&render_cond);
+      pthread_mutex_unlock(&render_lock);
+    }
+
+    t = 1000000000LL / fps - (now_ns() - frame_start);
+    if (t > 0)
+    {
+      struct timespec pause = {t / 1000000000LL, t % 1000000000LL};
+      nanosleep(&pause, NULL);
+    }
+  }
+  SDL_Quit();
+  return NULL;
+}
+
+int start_render(void)
+{
+  pthread_create(&render_thread, NULL, render_main, NULL);
+  pthread_mutex_lock(&render_lock);
+  while (render_status == 0)
+    pthread_cond_wait(&render_cond, &render_lock);
+  pthread_mutex_unlock(&render_lock);
+  if (render_status < 0)
+    pthread_join(render_thread, NULL);
+  return render_status > 0;
+}
+
+void stop_render(void)
+{
+  pthread_mutex_lock(&render_lock);
+  __atomic_store_n(&render_quit, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&render_cond);
+  pthread_mutex_unlock(&render_lock);
+  pthread_join(render_thread, NULL);
+}
+
+// Next window event for handle_events(), if any
+int next_command(SDL_Event *event)
+{
+  int found;
+
+  pthread_mutex_lock(&render_lock);
+  if ((found = ncommands > 0))
+  {
+    *event = commands[0];
+    memmove(commands, commands + 1, sizeof(SDL_Event) * --ncommands);
+  }
+  pthread_mutex_unlock(&render_lock);
+  return found;
+}
+
+// Runs the window events queued by the render thread. Only called between
+// ticks, so it may look at bots and change the run state.
+void handle_events(void)
+{
+  SDL_Event event;
+  struct bot *atual_dad;
+  int i, depth = 0;
+
+  while (next_command(&event))
+  {
+    switch (event.type)
+    {
+      case SDL_QUIT:
+        keypress = 1;
+        break;
+      case SDL_KEYDOWN:
+        switch (event.key.keysym.sym)
+        {
+          case SDLK_g:
+            get = 1;
+            break;
+          case SDLK_s:
+            show_stats = 1;
+            break;
+          case SDLK_v:
+            view = (view + 1) % 6;
+            switch (view)
+            {
+              case 0:
+                printf("Genetic View\n");
+              break;
+              case 1:
+                printf("Energy View\n");
+              break;
+              case 2:
+                printf("Age View\n");
+              break;
+              case 3:
+                printf("Generation View\n");
+              break;
+              case 4:
+                printf("Filtered Genetic View\n");
+              break;
+              case 5:
+                printf("Compatibility View\n");
+              break;
+            }
+            break;
+          case SDLK_PAGEUP:
+            frame_every = frame_every ? frame_every * 2 : 1;
+            printf("Drawing every %i ticks\n", frame_every);
+            break;
+          case SDLK_PAGEDOWN:
+            frame_every /= 2;
+            if (frame_every)
+              printf("Drawing every %i ticks\n", frame_every);
+            else
+              printf("Drawing as often as the display allows\n");
+            break;
+          case SDLK_UP:
+            ++food;
+            printf("More Food -> %i\n", food);
+            break;
+          case SDLK_DOWN:
+            --food;
+            printf("Less Food -> %i\n", food);
+            break;
+        }
+        break;
+      case SDL_MOUSEBUTTONDOWN:
+        if (event.button.button == 1)
+        {
+          if (at(POS(event.button.x, event.button.y)) != NULL)
           {
-            lb[b->p - 1] = &bots[last];
-            set_bot(&bots[last++], b, b->p - 1, b->energy / 5.0, b->new_gcode, lb, b->generation);
-            b->energy -= b->energy / 5.0;
+            atual_dad = at(POS(event.button.x, event.button.y));
+            while (atual_dad != NULL && depth < MAX_GENENARATION_UP_SHOW)
+            {
+              printf("#%i# generations up genoma# ", depth++);
+              if (depth == 1)
+              {
+                for (i = 0; i < MEM_SIZE - 1; i++)
+                {
+                  printf("%X,", gcode_of(atual_dad)[i]);
+                  selected[i] = gcode_of(atual_dad)[i];
+                }
+                printf("%X\n", gcode_of(atual_dad)[MEM_SIZE - 1]);
+                selected[MEM_SIZE - 1] = gcode_of(atual_dad)[MEM_SIZE - 1];
+                ++selected_version;
+              }
+              else
+              {
+                for (i = 0; i < MEM_SIZE - 1; i++)
+                {
+                  printf("%X,", gcode_of(atual_dad)[i]);
+                }
+                printf("%X\n", gcode_of(atual_dad)[MEM_SIZE - 1]);
+              }
+              atual_dad = resolve(atual_dad->dad);
+            }
+            printf("\n\n");
+            printf("##################\n");
+            depth = 0;
           }
           break;
-        case 3:
-          if (b->p + SX < SX * SY && lb[b->p + SX] == NULL)
+        }
+        else if (event.button.button == 3)
+        {
+          if (at(POS(event.button.x, event.button.y)) != NULL)
           {
-            lb[b->p + SX] = &bots[last];
-            set_bot(&bots[last++], b, b->p + SX, b->energy / 5.0, b->new_gcode, lb, b->generation);
-            b->energy -= b->energy / 5.0;
+            atual_dad = at(POS(event.button.x, event.button.y));
+            while (atual_dad != NULL && depth < 1)
+            {
+              printf("#%i# generations up genoma# ", depth++);
+              for (i = 0; i < MEM_SIZE - 1; i++)
+              {
+                printf("%X,", gcode_of(atual_dad)[i]);
+                selected[i] = gcode_of(atual_dad)[i];
+              }
+              printf("%X\n", gcode_of(atual_dad)[MEM_SIZE - 1]);
+              selected[MEM_SIZE - 1] = gcode_of(atual_dad)[MEM_SIZE - 1];
+              ++selected_version;
+              atual_dad = resolve(atual_dad->dad);
+            }
+            printf("\n");
+            printf("##################\n");
+            depth = 0;
           }
           break;
       }
-      break;
-    case 19:
-      if (b->last_adr < MEM_SIZE)
-        b->new_gcode[b->last_adr++] = b->gcode[b->pos++];
-      break;
+    }
   }
-  // b->memory[b->ptr] = b->memory[b->ptr] % 9;
 }
+#endif
+
+// --bench: fixed worlds and a few hot functions on their own, timed and
+// printed as one JSON object so runs can be compared from commit to commit.
+// The worlds start as copies of one genome on random cells, from a fixed
+// seed, and are thrown away afterwards.
+signed char bench_genome[MEM_SIZE] = {
+  10, 5, 16, 4, 15, 12, 12, 6, 5, 9, 9, 10, 10, 9, 12, 15, 11, 5, 10, 14, 4, 15, 8, 0, 12,
+  16, 10, 15, 14, 12, 19, 14, 9, 13, 19, 15, 16, 8, 17, 13, 16, 10, 3, 5, 4, 18, 15, 7, 5, 14};
 
-void setpixel(SDL_Surface *screen, int x, int y, int r, int g, int b)
+long peak_rss_kb(void)
 {
-  if (x < 0 || y < 0 || x >= SX || y >= SY || r < 0 || g < 0 || b < 0)
-    return;
-  if (r > 255)
-    r = 255;
-  if (g > 255)
-    g = 255;
-  if (b > 255)
-    b = 255;
-  Uint32 *pixmem32;
-  Uint32 colour;
+  struct rusage u;
+  getrusage(RUSAGE_SELF, &u);
+  return u.ru_maxrss;
+}
 
-  colour = SDL_MapRGB(screen->format, r, g, b);
+void clear_world(void)
+{
+  int i;
+  for (i = 0; i < last; i++)
+  {
+    set_cell(bots[live[i]].p, NO_BOT);
+    free_bot(&bots[live[i]]);
+  }
+  last = 0;
+  release_chunks();
+}
+
+// n bots with genome g on distinct random cells. Free cells take ever
+// longer to find as the world fills up, so a small --size gets at most
+// half its cells filled.
+void seed_world(int n, signed char *g, unsigned long long seed)
+{
+  struct bot *b;
+  long long p;
 
-  pixmem32 = (Uint32 *)screen->pixels + screen->w * y + x;
-  *pixmem32 = colour;
+  if (n > (long long)sx * sy / 2)
+    n = (long long)sx * sy / 2;
+  clear_world();
+  world_rng = seed;
+  reserve_slots(n);
+  while (last < n)
+  {
+    p = POS(rng_below(&world_rng, sx), rng_below(&world_rng, sy));
+    if (cell(p) != NO_BOT)
+      continue;
+    b = new_bot();
+    set_cell(p, b->self);
+    live[last++] = b->self & SLOT_MASK;
+    set_bot(b, NULL, p, 100000, g, 0, rng_split(&world_rng));
+    record_birth(b);
+  }
 }
 
-void reset_bot(struct bot *b) {
-  b->p = 0;
-  b->lp = 0;
-  b->energy = 0.0;
-  for (int i = 0; i < MEM_SIZE; i++) {
-    b->gcode[i] = 0;
-    b->memory[i] = 0;
-    b->new_gcode[i] = 0;
+void bench_world(int n, int ticks, unsigned long long seed)
+{
+  long long instructions = 0;
+  long born;
+  double start, elapsed;
+  int t;
+
+  seed_world(n, bench_genome, seed);
+  n = last;
+  for (t = 0; t < threads; t++)
+    workers[t].instructions = 0;
+  born = births;
+  start = now();
+  for (t = 0; t < ticks; t++)
+  {
+    ++tick;
+    tick_compute();
+    sweep_dead();
+    drop_food();
   }
-  b->nl = 0;
-  memset(b->loops, 0, sizeof(b->loops));
-  memset(b->loops_ptr, 0, sizeof(b->loops_ptr));
-  b->ptr = 0;
-  b->pos = 0;
-  b->dir = 0;
-  b->r = b->g = b->b = 0;
-  b->age = 0;
-  b->generation = 0;
-  b->last_adr = 0;
-  b->dad = NULL;
+  elapsed = now() - start;
+  for (t = 0; t < threads; t++)
+    instructions += workers[t].instructions;
+  printf("    {\"bots\": %i, \"ticks\": %i, \"seconds\": %.4f, \"ticks_per_s\": %.2f, \"instructions_per_s\": %.0f, "
+         "\"births_per_s\": %.0f, \"population\": %i, \"peak_rss_kb\": %li}",
+         n, ticks, elapsed, ticks / elapsed, instructions / elapsed, (births - born) / elapsed, last, peak_rss_kb());
+}
+
+// One bot running a genome made of "pattern" over and over, started again
+// from the top whenever it gets to the end, with or without four
+// neighbours. Any child it has is removed again, so the world stays the same.
+double bench_compute(signed char *pattern, int len, int with_neighbours, long calls)
+{
+  signed char g[MEM_SIZE];
+  long long p0 = POS(sx / 2, sy / 2), around[4];
+  int i;
+  struct worker *w = &workers[0];
+  struct bot *b, *child;
+  double start;
+  long c;
+
+  for (i = 0; i < MEM_SIZE; i++)
+    g[i] = pattern[i % len];
+  seed_world(0, g, 1);
+  b = new_bot();
+  set_cell(p0, b->self);
+  live[last++] = b->self & SLOT_MASK;
+  set_bot(b, NULL, p0, 1e9, g, 0, 1);
+  neighbours(p0, around);
+  for (i = 0; with_neighbours && i < 4; i++)
+  {
+    child = new_bot();
+    set_cell(around[i], child->self);
+    live[last++] = child->self & SLOT_MASK;
+    set_bot(child, NULL, around[i], 1e9, bench_genome, 0, i + 2);
+  }
+  for (i = 0; i < threads; i++)
+    workers[i].from = workers[i].to = 0;
+  w->to = 1;
+  hand_out_slots();
+
+  start = now();
+  for (c = 0; c < calls; c++)
+  {
+    if (b->pos >= MEM_SIZE)
+    {
+      b->pos = b->ptr = b->nl = b->last_adr = 0;
+      b->energy = 1e9;
+      b->age = max_age;
+      set_cell(b->p, NO_BOT);
+      set_cell(p0, b->self);
+      b->p = p0;
+    }
+    compute(b, w);
+    if (w->nborn)
+    {
+      child = &bots[w->born[--w->nborn]];
+      set_cell(child->p, NO_BOT);
+      free_bot(child);
+      if (w->nreserve == 0)
+        w->reserve[w->nreserve++] = free_slots[--nfree];
+    }
+  }
+  start = now() - start;
+  merge_spawns();
+  return start / calls * 1e9;
+}
+
+void run_bench(int ticks, unsigned long long seed)
+{
+  static signed char memory[] = {1, 3, 2, 4}, loops[] = {3, 5, 6}, sense[] = {7, 10}, turn[] = {8, 10, 11},
+               write[] = {9, 19, 0}, move[] = {12, 13}, energy[] = {16, 17, 10}, reproduce[] = {14, 11};
+  static int sizes[] = {10000, 100000, 1000000};
+  struct bot *a, *b;
+  double start;
+  long calls = 2000000, c;
+  int i, n, sum = 0;
+  float fsum = 0;
+
+  printf("{\n  \"version\": 1, \"threads\": %i, \"slice\": %i, \"seed\": %llu,\n  \"worlds\": [\n", threads, slice, seed);
+  for (i = 0; i < 3; i++)
+  {
+    bench_world(sizes[i], ticks, seed);
+    printf(i < 2 ? ",\n" : "\n");
+  }
+
+  printf("  ],\n  \"ns_per_call\": {\n");
+  printf("    \"compute/memory\": %.2f,\n", bench_compute(memory, 4, 0, calls));
+  printf("    \"compute/loop\": %.2f,\n", bench_compute(loops, 3, 0, calls));
+  printf("    \"compute/sense\": %.2f,\n", bench_compute(sense, 2, 1, calls));
+  printf("    \"compute/turn\": %.2f,\n", bench_compute(turn, 3, 0, calls));
+  printf("    \"compute/write\": %.2f,\n", bench_compute(write, 3, 0, calls));
+  printf("    \"compute/move\": %.2f,\n", bench_compute(move, 2, 0, calls));
+  printf("    \"compute/energy\": %.2f,\n", bench_compute(energy, 3, 1, calls));
+  printf("    \"compute/reproduce\": %.2f,\n", bench_compute(reproduce, 2, 0, calls / 10));
+
+  // Two genomes that only differ in the last gene, so compatible() has to
+  // draw
+  seed_world(2, bench_genome, seed);
+  a = &bots[live[0]];
+  b = &bots[live[1]];
+  release_genome(b->genome);
+  bench_genome[MEM_SIZE - 1]++;
+  b->genome = intern_genome(bench_genome);
+  b->species = genome_at(b->genome)->species;
+  bench_genome[MEM_SIZE - 1]--;
+  start = now();
+  for (c = 0; c < calls; c++)
+    sum += compatible(a, b);
+  printf("    \"compatible\": %.2f,\n", (now() - start) / calls * 1e9);
+  start = now();
+  for (c = 0; c < calls; c++)
+    fsum += compatibility(bench_genome, b);
+  printf("    \"compatibility\": %.2f,\n", (now() - start) / calls * 1e9);
+
+  // Half of a 100k world dies in random places, then is sown again
+  start = 0;
+  for (c = 0; c < 10; c++)
+  {
+    seed_world(100000, bench_genome, seed + c);
+    for (i = 0; i < last; i++)
+      if (rng_below(&world_rng, 2))
+        bots[live[i]].energy = 0;
+    n = last;
+    start -= now();
+    sweep_dead();
+    start += now();
+  }
+  printf("    \"sweep_dead_per_bot\": %.2f", start / (10.0 * n) * 1e9);
+
+#ifndef NO_SDL
+  {
+    // A snapshot and a frame of a 100k world after one tick, per bot
+    SDL_Surface *s = SDL_CreateRGBSurface(SDL_SWSURFACE, sx, sy, DEPTH, 0xff0000, 0xff00, 0xff, 0);
+    seed_world(100000, bench_genome, seed);
+    view = 1;
+    take_snapshot(&snapshots[0]);
+    draw_frame(s, &snapshots[0]);
+    ++tick;
+    tick_compute();
+    sweep_dead();
+    start = now();
+    take_snapshot(&snapshots[0]);
+    printf(",\n    \"snapshot_per_bot\": %.2f", (now() - start) / last * 1e9);
+    start = now();
+    draw_frame(s, &snapshots[0]);
+    printf(",\n    \"draw_frame_per_bot\": %.2f", (now() - start) / last * 1e9);
+    view = 0;
+    SDL_FreeSurface(s);
+  }
+#endif
+  printf("\n  },\n  \"checksum\": %i\n}\n", sum + (int)fsum); // keeps the loops above from being optimised out
+  clear_world();
+}
+
+// Ensemble runs (--ensemble FILE, in the ensemble build): many small worlds
+// at once for parameter sweeps, one per line of FILE, "food mutation seed"
+// and optionally a max-age, all of the --size and --wrap given and run for
+// --ticks N each. Every world runs on a thread of its own with its own
+// thread-local state, at most --pool N at a time (default: one per CPU), so
+// a world is never split between threads and --threads does not apply.
+// Worlds sample their stats every --ensemble-every N ticks (default: 100)
+// and at the end; once all are done the samples go to --ensemble-out FILE
+// (default: ensemble.txt) in world order, so the file does not depend on
+// which world finished first.
+struct ensemble_sample
+{
+  int tick, population, genomes, species;
+  float energy;
+  long births, deaths;
+};
+
+struct ensemble_world
+{
+  unsigned int seed;
+  int food, mutation;
+  float max_age;
+  struct ensemble_sample *samples;
+  int nsamples;
+  double seconds;
+};
+
+struct ensemble_world *worlds;
+int nworlds = 0, pool = 0, running = 0;
+int ensemble_every = 100;
+long ensemble_ticks;
+char *ensemble_out = "ensemble.txt";
+pthread_mutex_t ensemble_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ensemble_cond = PTHREAD_COND_INITIALIZER;
+
+// Gives back everything a world allocated, before its thread ends
+void free_world(void)
+{
+  struct chunk *c;
+  int i;
+
+  clear_world();
+  while ((c = chunk_pool) != NULL)
+  {
+    chunk_pool = c->next_free;
+    free(c);
+  }
+  free(active);
+  free(chunk_dir);
+  for (i = 0; i < MAX_GENOME_PAGES; i++)
+    free(genome_pages[i]);
+  free(genome_buckets);
+  free(species);
+  free(species_buckets);
+  for (i = 0; i < threads; i++)
+  {
+    free(workers[i].reserve);
+    free(workers[i].born);
+  }
+  free(workers);
+  free(tile_bots);
+  free(chunk_start);
+  for (i = 0; i < pool_cap; i++)
+    free(loop_spills[i].loops);
+  free(loop_spills);
+  free(bots);
+  free(free_slots);
+  free(live);
+}
+
+void sample_world(struct ensemble_world *e, float energy)
+{
+  struct ensemble_sample *s = &e->samples[e->nsamples++];
+
+  s->tick = tick;
+  s->population = last;
+  s->energy = energy;
+  s->births = births;
+  s->deaths = deaths;
+  s->genomes = genome_count;
+  s->species = species_count;
+}
+
+void *run_world(void *arg)
+{
+  struct ensemble_world *e = (struct ensemble_world *)arg;
+  double start = now();
+  float energy = 0;
+
+  e->samples = (struct ensemble_sample *)malloc(sizeof(struct ensemble_sample) * (ensemble_ticks / ensemble_every + 2));
+  world_rng = e->seed;
+  food = e->food;
+  VAR_TAX = e->mutation;
+  max_age = e->max_age;
+  reserve_slots(POOL_START);
+  init_world();
+  init_workers();
+  while (!keypress && tick < ensemble_ticks)
+  {
+    ++tick;
+    tick_compute();
+    energy = sweep_dead();
+    drop_food();
+    if (tick % ensemble_every == 0)
+      sample_world(e, energy);
+  }
+  if (tick % ensemble_every || e->nsamples == 0)
+    sample_world(e, energy);
+  free_world();
+  e->seconds = now() - start;
+
+  pthread_mutex_lock(&ensemble_lock);
+  --running;
+  pthread_cond_signal(&ensemble_cond);
+  pthread_mutex_unlock(&ensemble_lock);
+  return NULL;
+}
+
+// Reads the worlds of an ensemble file, one per line; # starts a comment
+int read_ensemble(char *name)
+{
+  struct ensemble_world *e;
+  char line[1024];
+  int n = 0, cap = 0;
+  FILE *f;
+
+  if ((f = fopen(name, "r")) == NULL)
+  {
+    perror(name);
+    return 0;
+  }
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    ++n;
+    line[strcspn(line, "#\n")] = 0;
+    if (line[strspn(line, " \t\r")] == 0)
+      continue;
+    if (nworlds == cap)
+    {
+      cap = cap ? cap * 2 : 64;
+      worlds = (struct ensemble_world *)realloc(worlds, sizeof(struct ensemble_world) * cap);
+    }
+    e = &worlds[nworlds];
+    memset(e, 0, sizeof(*e));
+    if (sscanf(line, "%i %i %u %f", &e->food, &e->mutation, &e->seed, &e->max_age) < 3 || e->food < 0 ||
+        e->food > 99 || e->mutation < 0 || e->max_age < 0)
+    {
+      fprintf(stderr, "%s:%i: expected \"food mutation seed [max-age]\", food up to 99\n", name, n);
+      fclose(f);
+      return 0;
+    }
+    if (e->max_age == 0)
+      e->max_age = max_age; // --max-age or the default
+    nworlds++;
+  }
+  fclose(f);
+  if (nworlds == 0)
+    fprintf(stderr, "%s: no worlds\n", name);
+  return nworlds > 0;
+}
+
+int run_ensemble(char *name, long ticks)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  struct ensemble_world *e;
+  struct ensemble_sample *s;
+  double start = now(), elapsed;
+  long total = 0;
+  FILE *out;
+  int i, j;
+
+  if (!read_ensemble(name))
+    return 0;
+  ensemble_ticks = ticks;
+  if (pool <= 0)
+    pool = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (i = 0; i < nworlds && !keypress; i++)
+  {
+    pthread_mutex_lock(&ensemble_lock);
+    while (running >= pool)
+      pthread_cond_wait(&ensemble_cond, &ensemble_lock);
+    ++running;
+    pthread_mutex_unlock(&ensemble_lock);
+    pthread_create(&thread, &attr, run_world, &worlds[i]);
+  }
+  nworlds = i; // the rest were never started
+  pthread_mutex_lock(&ensemble_lock);
+  while (running > 0)
+    pthread_cond_wait(&ensemble_cond, &ensemble_lock);
+  pthread_mutex_unlock(&ensemble_lock);
+  elapsed = now() - start;
+
+  if ((out = fopen(ensemble_out, "w")) == NULL)
+  {
+    perror(ensemble_out);
+    return 0;
+  }
+  fprintf(out, "# world seed food mutation max_age tick population energy births deaths genomes species\n");
+  for (i = 0; i < nworlds; i++)
+  {
+    e = &worlds[i];
+    for (j = 0; j < e->nsamples; j++)
+    {
+      s = &e->samples[j];
+      fprintf(out, "%i %u %i %i %g %i %i %f %li %li %i %i\n", i, e->seed, e->food, e->mutation, e->max_age, s->tick, s->population, s->energy, s->births, s->deaths,
+              s->genomes, s->species);
+    }
+    s = &e->samples[e->nsamples - 1];
+    total += s->tick;
+    printf("world %i: seed %u, food %i, mutation %i, ticks %i, seconds %.3f, population %i, energy %f, births %li, "
+           "deaths %li, genomes %i, species %i\n",
+           i, e->seed, e->food, e->mutation, s->tick, e->seconds, s->population, s->energy, s->births, s->deaths,
+           s->genomes, s->species);
+  }
+  if (ferror(out) | fclose(out))
+  {
+    perror(ensemble_out);
+    return 0;
+  }
+  printf("worlds %i, pool %i, seconds %.3f, world ticks/s %.1f\n", nworlds, pool, elapsed,
+         elapsed > 0 ? total / elapsed : 0);
+  return 1;
 }
 
 int main(int argc, char *argv[])
 {
-  srand(time(0));
-  FILE *file;
-  file = fopen("data.txt", "a+");
-  SDL_Surface *screen;
-  SDL_Event event;
+  unsigned int seed = time(0);
+  long max_ticks = 0, checkpoint_every = 10000;
+  char *lineage_name = NULL, *checkpoint_name = NULL, *restore_name = NULL, *ensemble_name = NULL;
+  int reseed = 0, k0, bench = 0;
+  int food_arg = -1, mutation_arg = -1; // applied after --restore
+  float max_age_arg = 0;
+  long long t;
+  double start;
   last = 0;
   float total_energy_sum = 0;
-  int keypress = 0, k = 0, i, position, j, food = 40, dr = 0, dg = 0, db = 0, depth = 0;
-  long long b = 0, v = 0;
+  int k = 0, i, dr = 0, dg = 0, db = 0, depth = 0;
+  int top[TOP_SPECIES], n;
   struct bot *atual_dad;
-  if (SDL_Init(SDL_INIT_VIDEO) < 0)
+
+  for (i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--headless"))
+      headless = 1;
+    else if (!strcmp(argv[i], "--bench"))
+      headless = bench = 1;
+    else if (!strcmp(argv[i], "--ticks") && i + 1 < argc)
+      max_ticks = atol(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+    {
+      seed = strtoul(argv[++i], NULL, 10);
+      reseed = 1;
+    }
+    else if (!strcmp(argv[i], "--size") && i + 1 < argc && sscanf(argv[i + 1], "%ix%i", &sx, &sy) == 2 && world_size_ok(sx, sy))
+      i++;
+    else if (!strcmp(argv[i], "--wrap"))
+      wrap = 1;
+    else if (!strcmp(argv[i], "--food") && i + 1 < argc)
+      food_arg = atoi(argv[++i]) > 0 ? (atoi(argv[i]) < 99 ? atoi(argv[i]) : 99) : 0;
+    else if (!strcmp(argv[i], "--mutation") && i + 1 < argc)
+      mutation_arg = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 0;
+    else if (!strcmp(argv[i], "--max-age") && i + 1 < argc)
+      max_age_arg = atof(argv[++i]) > 0 ? atof(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+      threads = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--ensemble") && i + 1 < argc)
+      ensemble_name = argv[++i];
+    else if (!strcmp(argv[i], "--ensemble-out") && i + 1 < argc)
+      ensemble_out = argv[++i];
+    else if (!strcmp(argv[i], "--ensemble-every") && i + 1 < argc)
+      ensemble_every = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--pool") && i + 1 < argc)
+      pool = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--procs") && i + 1 < argc)
+      procs = atoi(argv[++i]) > 1 ? atoi(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--slice") && i + 1 < argc)
+      slice = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--lineage") && i + 1 < argc)
+      lineage_name = argv[++i];
+    else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc)
+      checkpoint_name = argv[++i];
+    else if (!strcmp(argv[i], "--checkpoint-every") && i + 1 < argc)
+      checkpoint_every = atol(argv[++i]) > 0 ? atol(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--restore") && i + 1 < argc)
+      restore_name = argv[++i];
+    else if (!strcmp(argv[i], "--telemetry") && i + 1 < argc)
+      telemetry_name = argv[++i];
+    else if (!strcmp(argv[i], "--telemetry-gzip"))
+      telemetry_gzip = 1;
+    else if (!strcmp(argv[i], "--telemetry-rotate") && i + 1 < argc)
+      telemetry_rotate = atol(argv[++i]) * 1024L * 1024L;
+    else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+      frames_prefix = argv[++i];
+    else if (!strcmp(argv[i], "--frames-every") && i + 1 < argc)
+      frames_every = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--frames-scale") && i + 1 < argc && parse_scales(argv[i + 1]))
+      i++;
+    else if (!strcmp(argv[i], "--frames-stream"))
+      frames_stream = 1;
+    else if (!strcmp(argv[i], "--view") && i + 1 < argc)
+      view = abs(atoi(argv[++i])) % 6;
+#ifndef NO_SDL
+    else if (!strcmp(argv[i], "--fps") && i + 1 < argc)
+      fps = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+    else if (!strcmp(argv[i], "--frame-every") && i + 1 < argc)
+      frame_every = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 0;
+#endif
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+#ifdef NO_SDL
+  headless = 1;
+#endif
+#ifdef ENSEMBLE
+  // World state is per thread in this build, --bench included
+  threads = 1;
+#else
+  if (ensemble_name != NULL)
+  {
+    fprintf(stderr, "--ensemble: only in the ensemble build (make ensemble)\n");
     return 1;
+  }
+#endif
+  world_rng = seed;
 
-  if (!(screen = SDL_SetVideoMode(WIDTH, HEIGHT, DEPTH, SDL_HWSURFACE)))
+  if (headless)
   {
-    SDL_Quit();
+    signal(SIGINT, stop_running);
+    signal(SIGTERM, stop_running);
+    signal(SIGUSR1, request_stats);
+  }
+  reserve_slots(POOL_START);
+  init_world();
+  if (bench)
+  {
+    init_workers();
+    start_workers();
+    run_bench(max_ticks ? max_ticks : 100, reseed ? seed : 1);
+    stop_workers();
+    return 0;
+  }
+  if (ensemble_name != NULL && (max_ticks <= 0 || lineage_name != NULL || checkpoint_name != NULL ||
+                                restore_name != NULL || frames_prefix != NULL || procs > 1))
+  {
+    fprintf(stderr, "--ensemble: needs --ticks N, and not --lineage, --checkpoint, --restore, --frames or --procs\n");
     return 1;
   }
-  short selected[MEM_SIZE];
-  bots = (struct bot *)malloc(sizeof(struct bot) * SX * SY);
-  struct bot **lb = (struct bot **)malloc(sizeof(struct bot *) * SX * SY);
-  for (i = 0; i < SX * SY; i++)
+  if (procs > 1 &&
+      (!headless || lineage_name != NULL || checkpoint_name != NULL || restore_name != NULL || frames_prefix != NULL))
   {
-    lb[i] = NULL;
+    fprintf(stderr, "--procs: only headless, without --lineage, --checkpoint, --restore or --frames\n");
+    return 1;
   }
-  short g[MEM_SIZE]; //{
+  if (restore_name != NULL && !restore_checkpoint(restore_name, reseed, seed))
+    return 1;
+  if (food_arg >= 0)
+    food = food_arg;
+  if (mutation_arg >= 0)
+    VAR_TAX = mutation_arg;
+  if (max_age_arg > 0)
+    max_age = max_age_arg;
+  if (procs > 1)
+    return run_procs(max_ticks) ? 0 : 1;
+  if (ensemble_name != NULL)
+    return run_ensemble(ensemble_name, max_ticks) ? 0 : 1;
+#ifndef NO_SDL
+  if (!headless && !start_render())
+    return 1;
+#endif
+  k = k0 = tick;
+  if (max_ticks)
+    max_ticks += k;
+  if (lineage_name != NULL && (lineage = open_lineage(lineage_name)) == NULL)
+    return 1;
+  if (!start_telemetry())
+    return 1;
+  // short g[MEM_SIZE] = {
   // 7, 4, 8, 0, 2, 7, 0, 9, 4, 2, 9, 6, 2, 4, 4, 2, 9, 3, 2, 7, 2, 0, 2, 0, 3, 4, 6, 2, 2, 2, 2, 1, 8, 0, 2, 8, 8, 5, 9, 2, 9, 6, 7, 5, 8, 8, 6, 9, 2, 8
   // 7, 6, 8, 8, 7, 3, 3, 9, 4, 4, 9, 6, 8, 0, 6, 4, 9, 2, 2, 6, 9, 6, 2, 0, 3, 4, 6, 7, 2, 2, 2, 1, 8, 0, 9, 8, 5, 5, 7, 2, 9, 6, 8, 0, 8, 6, 6, 9, 9, 9
   //-1, -1, 3, 7, 11, 15, 19, 23, 27, 31, 35, 39, 43, 11, 51, 55, 5, 63, 67, 71, 75, 79, 83, 87, 91, 95, 13, 9, 107, 111, 115, 3, 123, 127, 131, 135, 139, 143, 147, 13, 155, 8, 163, 167, 171, 175, 179, 183, 187, 191, 195, 199, 203, 207, 211, 215, 219, 223, 227, 231, 235, 239, 243, 247, 251, 255, 259, 263, 267, 271, 275, 279, 283, 287, 291, 295, 299, 303, 307, 311, 315, 13, 323, 327, 331, 335, 339, 343, 347, 351, 355, 359, 363, 367, 6, 375, 9, 383, 387, 391, 6, 3, 7, 14, 13, 9, 13, 6, 3, 0, 10, 0, 4, 12, 13, 12, 12, 2, 8, 12, 14, 15, 1, 6, 2, 0, 1, 12, 12, 4, 16, 1, 7, 11, 6, 11, 4, 10, 0, 15, 10, 11, 15, 14, 14, 2, 9, 0, 4, 9, 13, 1, 15, 14, 7, 0, 5, 16, 12, 8, 12, 16, 0, 10, 2, 6, 5, 14, 0, 5, 12, 10, 7, 1, 8, 4, 3, 8, 5, 15, 0, 9, 16, 7, 14, 15, 16, 10, 5, 2, 5, 0, 2, 1, 11, 12, 15, 7, 9, 15
   //};
   // for (i = 0; i < 0; i++)
-  //	set_bot(&bots[last++], NULL, rand() % (SX * SY), 1000, g, lb, 0);
-  short get = 0, view = 0;
-  float comp;
-  while (!keypress)
+  //	set_bot(&bots[last++], NULL, rand() % (cells), 1000, g, 0);
+  init_workers();
+  start_workers();
+  start = now();
+  while (!keypress && (!max_ticks || k < max_ticks))
   {
-    ++k;
-    for (i = 0; i < last; i++)
-    {
-      compute(&bots[i], lb);
-      switch (view)
-      {
-        case 0:
-          setpixel(screen, bots[i].p % SX, bots[i].p / SX % SY, bots[i].r, bots[i].g, bots[i].b);
-          break;
-        case 1:
-          setpixel(screen, bots[i].p % SX, bots[i].p / SX % SY, bots[i].energy, bots[i].energy / 10.0, bots[i].energy / 100.0);
-          break;
-        case 2:
-          setpixel(screen, bots[i].p % SX, bots[i].p / SX % SY, bots[i].age / MAX_AGE * 255, bots[i].age / MAX_AGE * 255, bots[i].age / MAX_AGE * 255);
-          break;
-        case 3:
-          if (bots[i].generation > 2)
-            setpixel(screen, bots[i].p % SX, bots[i].p / SX % SY, bots[i].generation / 100.0, bots[i].generation / 100.0, bots[i].generation / 100.0);
-          break;
-        case 4:
-          if (bots[i].generation > 1)
-            setpixel(screen, bots[i].p % SX, bots[i].p / SX % SY, bots[i].r, bots[i].g, bots[i].b);
-          break;
-        case 5:
-          if (selected != NULL)
-          {
-            comp = compatibility(selected, &bots[i]) * 255;
-            setpixel(screen, bots[i].p % SX, bots[i].p / SX % SY, comp, comp, comp);
-          }
-          break;
-      }
-    }
-    for (i = 0; i < SX * SY; i++)
-    {
-      lb[i] = NULL;
-    }
-    total_energy_sum = 0;
-    for (i = 0; i < last; ) // Remove the increment from here
-    {
-      if (bots[i].energy > 0 && bots[i].age > 0)
-      {
-        // Bot is alive, update its position in the lb array and increment i
-        lb[bots[i].p] = &bots[i];
-        total_energy_sum += bots[i].energy;
-        i++; // Move to the next bot only if the current bot is not removed
-      }
-      else
-    {
-        // Bot is dead, clear its position in the lb array
-        lb[bots[i].p] = NULL;
-
-        if (i != last - 1) // Check if it's not already the last bot
-        {
-          // Move the last bot to the current position
-          bots[i] = bots[--last];
-
-          // Update the lb array to reflect the moved bot's new position
-          lb[bots[i].p] = &bots[i];
-        }
-        else
-      {
-          // If it's the last bot, just decrement last
-          --last;
-          break; // No need to increment i, as we're done with this bot
-        }
-
-        // Do not increment i, as we need to check the bot that was moved to position i
-      }
-    }
+    tick = ++k;
+    t = now_ns();
+    tick_compute();
+    t = end_phase(PHASE_COMPUTE, t);
+    total_energy_sum = sweep_dead();
+    t = end_phase(PHASE_SWEEP, t);
 
+    // A best bot that died is replaced at the next scan
+    if (resolve(best) == NULL)
+      best_energy = 0;
     for (i = 0; i < last; i++)
     {
+      struct bot *bt = &bots[live[i]];
       if (k % 10 == 0)
       {
-        if (bots[i].energy > v && bots[i].generation > 20)
+        if (bt->energy > best_energy && bt->generation > 20)
         {
-          b = i;
-          v = bots[i].energy;
+          best = bt->self;
+          best_energy = bt->energy;
         }
       }
       else if (get)
       {
-        dr += bots[i].r;
-        dg += bots[i].g;
-        db += bots[i].b;
-        if (bots[i].energy > v && bots[i].generation > 20)
+        dr += genome_at(bt->genome)->r;
+        dg += genome_at(bt->genome)->g;
+        db += genome_at(bt->genome)->b;
+        if (bt->energy > best_energy && bt->generation > 20)
         {
-          b = i;
-          v = bots[i].energy;
+          best = bt->self;
+          best_energy = bt->energy;
         }
       }
     }
     if (get)
     {
-      printf("Mean Color -> (%f, %f, %f)\n", dr / (float)last, dg / (float)last, db / (float)last);
+      if (last > 0)
+        printf("Mean Color -> (%f, %f, %f)\n", dr / (float)last, dg / (float)last, db / (float)last);
+      printf("Distinct genomes -> %i\n", genome_count);
+      printf("Species -> %i\n", species_count);
+      n = top_species(top, TOP_SPECIES);
+      for (i = 0; i < n; i++)
+        printf("  species %u: %i bots, %i genomes, energy %f\n", species[top[i]].label, species[top[i]].population,
+               species[top[i]].genomes, species[top[i]].energy);
       dr = 0;
       dg = 0;
       db = 0;
-      printf("Atual best cell specification:");
-      v = 0;
-      atual_dad = &bots[b];
+      best_energy = 0;
+      if ((atual_dad = resolve(best)) != NULL)
+        printf("Atual best cell specification (id %llu):", atual_dad->id);
       while (atual_dad != NULL && depth < MAX_GENENARATION_UP_SHOW)
       {
         printf("#%i# generations up genoma# ", depth++);
         for (i = 0; i < MEM_SIZE - 1; i++)
         {
-          printf("%i, ", atual_dad->gcode[i]);
+          printf("%i, ", gcode_of(atual_dad)[i]);
         }
-        printf("%i\n", atual_dad->gcode[MEM_SIZE - 1]);
-        atual_dad = atual_dad->dad;
+        printf("%i\n", gcode_of(atual_dad)[MEM_SIZE - 1]);
+        atual_dad = resolve(atual_dad->dad);
       }
       printf("\n\n");
       printf("##################\n");
       depth = 0;
       get = 0;
     }
-    for (j = 0; rand() % 100 < food; j++)
+    t = end_phase(PHASE_BEST, t);
+    drop_food();
+    t = end_phase(PHASE_FOOD, t);
+    if (k % 10 == 0)
     {
-      position = rand() % (SX * SY);
-      for (i = 0; i < MEM_SIZE; i++)
-      {
-        g[i] = rand() % 20;
-      }
-      if (lb[position] == NULL)
-        set_bot(&bots[last++], NULL, position, 100000, g, lb, 0);
+      atual_dad = resolve(best);
+      push_telemetry(last, total_energy_sum, genome_count, atual_dad != NULL ? gcode_of(atual_dad) : NULL);
     }
-    if (k % 10 == 0)
+    if (checkpoint_name != NULL && k % checkpoint_every == 0)
+      background_checkpoint(checkpoint_name);
+    t = end_phase(PHASE_LOG, t);
+    if (frames_prefix != NULL && k % frames_every == 0)
     {
-      for (i = 0; i < MEM_SIZE - 1; i++)
-      {
-        fprintf(file, "%i, ", bots[b].gcode[i]);
-      }
-      fprintf(file, "%i, %i, %f\n", bots[b].gcode[i], last, total_energy_sum);
+      export_frames();
+      t = end_phase(PHASE_FRAMES, t);
     }
-    if (view != 6)
+    if (show_stats)
     {
-      SDL_Flip(screen);
-      // sprintf(buf ,"%d", k / 100);
-      // SDL_SaveBMP(screen, buf);
-      SDL_FillRect(screen, NULL, 0x000000);
+      print_phase_times();
+#ifdef VM_STATS
+      print_vm_stats();
+#endif
+      show_stats = 0;
     }
-    while (SDL_PollEvent(&event))
+#ifndef NO_SDL
+    if (!headless)
     {
-      switch (event.type)
-      {
-        case SDL_QUIT:
-          keypress = 1;
-          break;
-        case SDL_KEYDOWN:
-          switch (event.key.keysym.sym)
-          {
-            case SDLK_g:
-              get = 1;
-              break;
-            case SDLK_v:
-              view = (view + 1) % 7;
-              switch (view)
-              {
-                case 0:
-                  printf("Genetic View\n");
-                break;
-                case 1:
-                  printf("Energy View\n");
-                break;
-                case 2:
-                  printf("Age View\n");
-                break;
-                case 3:
-                  printf("Generation View\n");
-                break;
-                case 4:
-                  printf("Filtered Genetic View\n");
-                break;
-                case 5:
-                  printf("Compatibility View\n");
-                break;
-                case 6:
-                  printf("Don't rendening\n");
-                  SDL_FillRect(screen, NULL, 0x000000);
-                break;
-              }
-              break;
-            case SDLK_UP:
-              ++food;
-              printf("More Food -> %i\n", food);
-              break;
-            case SDLK_DOWN:
-              --food;
-              printf("Less Food -> %i\n", food);
-              break;
-          }
-          break;
-        case SDL_MOUSEBUTTONDOWN:
-          if (event.button.button == 1)
-          {
-            if (lb[event.button.x + SX * event.button.y] != NULL)
-            {
-              v = 0;
-              atual_dad = lb[event.button.x + SX * event.button.y];
-              while (atual_dad != NULL && depth < MAX_GENENARATION_UP_SHOW)
-              {
-                printf("#%i# generations up genoma# ", depth++);
-                if (depth == 1)
-                {
-                  for (i = 0; i < MEM_SIZE - 1; i++)
-                  {
-                    printf("%X,", atual_dad->gcode[i]);
-                    selected[i] = atual_dad->gcode[i];
-                  }
-                  printf("%X\n", atual_dad->gcode[MEM_SIZE - 1]);
-                  selected[MEM_SIZE - 1] = atual_dad->gcode[MEM_SIZE - 1];
-                }
-                else
-                {
-                  for (i = 0; i < MEM_SIZE - 1; i++)
-                  {
-                    printf("%X,", atual_dad->gcode[i]);
-                  }
-                  printf("%X\n", atual_dad->gcode[MEM_SIZE - 1]);
-                }
-                atual_dad = atual_dad->dad;
-              }
-              printf("\n\n");
-              printf("##################\n");
-              depth = 0;
-            }
-            break;
-          }
-          else if (event.button.button == 3)
-          {
-            if (lb[event.button.x + SX * event.button.y] != NULL)
-            {
-              v = 0;
-              atual_dad = lb[event.button.x + SX * event.button.y];
-              while (atual_dad != NULL && depth < 1)
-              {
-                printf("#%i# generations up genoma# ", depth++);
-                for (i = 0; i < MEM_SIZE - 1; i++)
-                {
-                  printf("%X,", atual_dad->gcode[i]);
-                  selected[i] = atual_dad->gcode[i];
-                }
-                printf("%X\n", atual_dad->gcode[MEM_SIZE - 1]);
-                selected[MEM_SIZE - 1] = atual_dad->gcode[MEM_SIZE - 1];
-                atual_dad = atual_dad->dad;
-              }
-              printf("\n");
-              printf("##################\n");
-              depth = 0;
-            }
-            break;
-        }
-      }
+      t = now_ns();
+      if (frame_every == 0 || k % frame_every == 0)
+        publish_frame();
+      t = end_phase(PHASE_SNAPSHOT, t);
+      handle_events();
+      end_phase(PHASE_EVENTS, t);
     }
+#endif
+  }
+  stop_workers();
+  if (headless)
+    print_phase_times();
+#ifdef VM_STATS
+  print_vm_stats();
+#endif
+  if (checkpoint_name != NULL)
+  {
+    reap_snapshot(0);
+    if (!save_checkpoint(checkpoint_name))
+      perror(checkpoint_name);
+  }
+  if (headless)
+  {
+    double elapsed = now() - start;
+    printf("ticks %i, seconds %.3f, ticks/s %.1f, population %i, energy %f, births %li, deaths %li, genomes %i\n",
+           k, elapsed, elapsed > 0 ? (k - k0) / elapsed : 0, last, total_energy_sum, births, deaths, genome_count);
   }
+  stop_telemetry();
+  close_frames();
+  if (lineage != NULL)
+    fclose(lineage);
+#ifndef NO_SDL
+  if (!headless)
+    stop_render();
+#endif
   return (0);
 }
@@ -0,0 +1,88 @@
+#Nanolife - Simple artificial life simulator
+
+#Copyright 2011 Mateus Zitelli <zitellimateus@gmail.com>
+
+#This program is free software; you can redistribute it and/or modify
+#it under the terms of the GNU General Public License as published by
+#the Free Software Foundation; either version 2 of the License, or
+#(at your option) any later version.
+
+#This program is distributed in the hope that it will be useful,
+#but WITHOUT ANY WARRANTY; without even the implied warranty of
+#MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#GNU General Public License for more details.
+
+#You should have received a copy of the GNU General Public License
+#along with this program; if not, write to the Free Software
+#Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#MA 02110-1301, USA.
+
+# Turns the telemetry written by "b.bin --telemetry FILE" back into the
+# lines the simulator used to append to data.txt:
+#
+#   python telemetry_reader.py data.bin.1 data.bin.2 data.bin > data.txt
+#
+# Give rotated files oldest first. Gzipped files are read as they are.
+# With --species, prints instead a line per species in each record of a
+# version 3 file: tick, label, bots, genomes, energy, and the births and
+# deaths since the record before.
+from __future__ import print_function
+import gzip
+import struct
+import sys
+
+HEADER = struct.Struct('<4sIII')
+# Genes are shorts in version 1 files and signed bytes from version 2
+GENE = {1: 'h', 2: 'b', 3: 'b'}
+TOP_SPECIES = 8
+
+def records(name):
+        f = open(name, 'rb')
+        if f.read(2) == b'\x1f\x8b':
+                f.close()
+                f = gzip.open(name, 'rb')
+        else:
+                f.seek(0)
+        record = None
+        while True:
+                # A restarted run appends a new header
+                head = f.read(4)
+                if len(head) < 4:
+                        return
+                if head == b'NLTM':
+                        magic, version, mem_size, record_size = HEADER.unpack(head + f.read(HEADER.size - 4))
+                        if version not in GENE:
+                                raise ValueError('%s: not a version 1 to 3 telemetry file' % name)
+                        layout = '<IifI%d%s' % (mem_size, GENE[version])
+                        if version >= 3:
+                                # Species counts, after padding to an int
+                                layout += '%dxi' % (-struct.calcsize(layout) % 4) + 'IiifII' * TOP_SPECIES
+                        record = struct.Struct(layout)
+                        pad = record_size - record.size
+                        continue
+                if record is None:
+                        raise ValueError('%s: not a telemetry file' % name)
+                data = head + f.read(record.size - 4 + pad)
+                if len(data) < record.size:
+                        return
+                r = record.unpack_from(data)
+                n = 4 + mem_size
+                top = [r[i:i + 6] for i in range(n + 1, len(r), 6)]
+                yield {'tick': r[0], 'population': r[1], 'energy': r[2], 'genomes': r[3], 'gcode': r[4:n],
+                       'species': r[n] if len(r) > n else None,
+                       'top': [dict(zip(('label', 'population', 'genomes', 'energy', 'births', 'deaths'), t))
+                               for t in top if t[0]]}
+
+if __name__ == "__main__":
+        names = [a for a in sys.argv[1:] if a != '--species']
+        if not names:
+                print('usage: telemetry_reader.py [--species] FILE...')
+                sys.exit(1)
+        for name in names:
+                for r in records(name):
+                        if '--species' in sys.argv:
+                                for t in r['top']:
+                                        print('%i %i %i %i %f %i %i' % (r['tick'], t['label'], t['population'], t['genomes'],
+                                                                    t['energy'], t['births'], t['deaths']))
+                        else:
+                                print(''.join('%i, ' % g for g in r['gcode']) + '%i, %f' % (r['population'], r['energy']))